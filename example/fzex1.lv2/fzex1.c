@@ -29,6 +29,8 @@
 #include <atom.lv2/util.h>
 
 /* libfreeztile headers.  */
+#include "../../src/malloc.h"
+#include "../../src/arena.h"
 #include "../../src/class.h"
 #include "../../src/voice.h"
 #include "../../src/node.h"
@@ -43,6 +45,7 @@
 #define POLYPHONY 4
 #define NUM_ENGINES 2
 #define NUM_CHANNELS 2
+#define ARENA_SIZE (64 << 20)
 
 /* Named port numbers.  */
 enum {
@@ -116,6 +119,9 @@ typedef struct {
   graph_t *graph;
   Engine engines[NUM_ENGINES];
   node_t *sinks[NUM_CHANNELS];
+  bool_t arena; /* TRUE if holding a reservation of the arena.  */
+  bool_t reclaim; /* TRUE if using the shared reclaimer.  */
+  bool_t pooled; /* TRUE if holding a reservation of voice objects.  */
 } FzEx1;
 
 /* Create a new instance of this plugin. This function is called by
@@ -165,7 +171,24 @@ static void
 activate (LV2_Handle instance)
 {
   FzEx1 *plugin = (FzEx1 *) instance;
+
+  /* Let all library objects draw from a preallocated arena so note
+     bursts in `run' don't contend for the C library allocator.  The
+     arena is shared by all instances.  If it can't be reserved this
+     instance makes do with the current allocator.  */
+  plugin->arena = fz_arena_reserve (ARENA_SIZE) == 0;
+
+  /* Have blocks released in `run' reclaimed by a background thread,
+     which is shared by all instances.  */
+  plugin->reclaim = fz_reclaim_start () == 0;
+
   plugin->voice_pool = fz_new (vpool_c, POLYPHONY);
+
+  /* LFOs create a voice of their own for every voice they modulate
+     in `run', so keep a pool of warm voice objects for them.  The pool
+     is shared by all instances, each adding its own reservation.  */
+  plugin->pooled = fz_class_reserve (voice_c, POLYPHONY * NUM_ENGINES) > 0;
+
   plugin->graph = fz_new (graph_c);
 
   /* Create and connect engine objects.  */
@@ -224,10 +247,14 @@ activate (LV2_Handle instance)
                           plugin->sinks[ci]);
     }
 
-  /* Prepare graph to generate a fairly large number of samples here
-     to reduce the chance of reallocation of internal buffers in the
-     time sensitive `run' function.  */
-  fz_graph_prepare (plugin->graph, 8192);
+  /* Allocate buffers for a fairly large number of samples and states
+     for every voice here so the time sensitive `run' function doesn't
+     have to allocate or page fault.  */
+  fz_graph_reserve (plugin->graph,
+                    fz_vpool_all_voices (plugin->voice_pool),
+                    8192, FALSE);
+  if (plugin->arena)
+    fz_arena_prefault (FALSE);
 }
 
 /* Macro for accessing a given port for a specific engine.  */
@@ -311,6 +338,9 @@ static void
 run (LV2_Handle instance, uint32_t nsamples)
 {
   FzEx1 *plugin = (FzEx1 *) instance;
+
+  /* Blocks released from here on are reclaimed outside of `run'.  */
+  fz_rt_enter ();
   update_engine_controls (plugin);
 
   /* Look for new midi events.  */
@@ -362,7 +392,13 @@ run (LV2_Handle instance, uint32_t nsamples)
          reallocated unless NSAMPLES is a really large number.  */
       fz_graph_prepare (plugin->graph, nsamples);
 
-      fz_graph_render (plugin->graph, voice);
+      if (fz_graph_render (plugin->graph, voice) < 0)
+        {
+          /* Most likely out of memory for the voice states, drop the
+             voice rather than the whole block.  */
+          fz_vpool_kill (plugin->voice_pool, voice);
+          continue;
+        }
 
       /* Copy samples from graph sinks to the output ports.  */
       for (uint_t oi = 0; oi < NUM_CHANNELS; ++oi)
@@ -387,6 +423,8 @@ run (LV2_Handle instance, uint32_t nsamples)
       /* if (voice_is_silent) */
       /*   fz_vpool_kill (plugin->voice_pool, voice); */
     }
+
+  fz_rt_leave ();
 }
 
 /* Free any resources allocated in `activate'.  */
@@ -402,6 +440,19 @@ deactivate (LV2_Handle instance)
   /* Sinks and engine forms are released by graph.  */
   fz_del (plugin->graph);
   fz_del (plugin->voice_pool);
+  if (plugin->pooled)
+    fz_class_release (voice_c, POLYPHONY * NUM_ENGINES);
+  plugin->pooled = FALSE;
+  /* The last instance stops the reclaimer and releases what's left
+     in its queue.  */
+  if (plugin->reclaim)
+    fz_reclaim_stop ();
+  plugin->reclaim = FALSE;
+  /* The arena is freed with the last reservation, unless blocks are
+     still in use, in which case it's kept for later instances.  */
+  if (plugin->arena)
+    fz_arena_release ();
+  plugin->arena = FALSE;
 }
 
 /* Free any resources allocated in `instantiate'.  */
@@ -20,6 +20,7 @@
 #include "adsr.h"
 #include "mod.h"
 #include "private-mod.h"
+#include "private-list.h"
 #include "defs.h"
 
 /* Struct to keep track of individual voice states.  */
@@ -61,7 +62,7 @@ adsr_render (mod_t *mod, const voice_t *voice)
   struct state_s *state = fz_mod_state (mod, voice, struct state_s);
 
   if (state == NULL)
-    return -EINVAL;
+    return voice == NULL ? -EINVAL : -ENOMEM;
 
   pressed = fz_voice_pressed (voice);
   pressure = fz_voice_pressure (voice);
@@ -97,8 +98,8 @@ adsr_render (mod_t *mod, const voice_t *voice)
       state->pos = 0;
     }
 
-  nrendered = fz_len (mod->stepbuf);
-  steps = (real_t *) fz_list_data (mod->stepbuf);
+  nrendered = real_vector_len (mod->stepbuf);
+  steps = real_vector_data (mod->stepbuf);
 
   for (i = 0; i < nrendered; ++i)
     {
@@ -175,6 +176,20 @@ adsr_render (mod_t *mod, const voice_t *voice)
   return nrendered;
 }
 
+/* `resetstate' callback.  Silences the envelope but keeps its last
+   amplitude, so the next attack of a stolen voice starts from where
+   the previous note was cut off instead of clicking.  */
+static void
+adsr_resetstate (mod_t *mod, ptr_t state)
+{
+  (void) mod;
+  struct state_s *_state = (struct state_s *) state;
+  _state->state = ADSR_STATE_SILENT;
+  _state->pos = 0;
+  _state->freq = 0;
+  _state->ra = _state->pa;
+}
+
 /* ADSR constructor.  */
 static ptr_t
 adsr_constructor (ptr_t ptr, va_list *args)
@@ -182,6 +197,8 @@ adsr_constructor (ptr_t ptr, va_list *args)
   adsr_t *self = (adsr_t *)
     ((const class_t *) mod_c)->construct (ptr, args);
   self->__parent.render = adsr_render;
+  self->__parent.resetstate = adsr_resetstate;
+  self->__parent.state_size = sizeof (struct state_s);
   self->al = 0.00;
   self->aa = 1.00;
   self->dl = 0.00;
@@ -0,0 +1,328 @@
+/* Preallocated, lock-free arena allocator backend.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "arena.h"
+#include "malloc.h"
+#include "slab.h"
+
+#define ARENA_GRAIN 16
+#define ARENA_ALIGNMENT 64
+#define ARENA_PAGE_SIZE 4096
+#define ARENA_MIN_BIN 5 /* 32 bytes.  */
+#define ARENA_NUM_BINS 64
+
+/* Blocks are linked by their offset in grains from the arena base,
+   plus one so that zero can mark the end of a list.  */
+#define ARENA_LINK(ptr) \
+  ((uint32_t) ((((char *) (ptr)) - arena.base) / ARENA_GRAIN) + 1)
+
+#define ARENA_BLOCK(link) \
+  (arena.base + ((size_t) ((link) - 1) * ARENA_GRAIN))
+
+/* A bin head packs an ABA tag in its upper and a block link in its
+   lower 32 bits so it can be swapped with a single CAS.  */
+#define BIN_HEAD(tag, link) \
+  ((((uint64_t) (tag)) << 32) | (uint64_t) (link))
+
+/* The process wide arena.  USERS counts unbalanced reservations.  */
+static struct
+{
+  char *base;
+  size_t size;
+  size_t top;
+  size_t used;
+  uint_t users;
+  const allocator_t *prev;
+  uint64_t bins[ARENA_NUM_BINS];
+} arena;
+
+/* Serializes reservation and release of the arena.  */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Get the index of the smallest bin that fits LEN bytes.  */
+static inline uint_t
+arena_bin (size_t len)
+{
+  if (len <= (1 << ARENA_MIN_BIN))
+    return ARENA_MIN_BIN;
+  return 64 - __builtin_clzll ((unsigned long long) len - 1);
+}
+
+/* Pop a free block from BIN or return NULL if it's empty.  */
+static ptr_t
+arena_pop (uint_t bin)
+{
+  uint64_t *head = &arena.bins[bin];
+  uint64_t curr = __atomic_load_n (head, __ATOMIC_ACQUIRE);
+  uint32_t link;
+  uint32_t next;
+
+  do
+    {
+      link = (uint32_t) curr;
+      if (link == 0)
+        return NULL;
+      /* NEXT may be garbage if the block was popped concurrently but
+         then the tag has changed and the CAS will fail.  */
+      next = __atomic_load_n ((uint32_t *) ARENA_BLOCK (link),
+                              __ATOMIC_RELAXED);
+    }
+  while (!__atomic_compare_exchange_n (head, &curr,
+                                       BIN_HEAD ((curr >> 32) + 1, next),
+                                       TRUE, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE));
+
+  return ARENA_BLOCK (link);
+}
+
+/* Push block PTR onto the free list of BIN.  */
+static void
+arena_push (uint_t bin, ptr_t ptr)
+{
+  uint64_t *head = &arena.bins[bin];
+  uint64_t curr = __atomic_load_n (head, __ATOMIC_RELAXED);
+  uint32_t link = ARENA_LINK (ptr);
+
+  do
+    __atomic_store_n ((uint32_t *) ptr, (uint32_t) curr,
+                      __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n (head, &curr,
+                                       BIN_HEAD ((curr >> 32) + 1, link),
+                                       TRUE, __ATOMIC_RELEASE,
+                                       __ATOMIC_RELAXED));
+}
+
+/* Carve LEN bytes aligned to ALIGN off the top of the arena.  */
+static ptr_t
+arena_bump (size_t len, size_t align)
+{
+  size_t curr = __atomic_load_n (&arena.top, __ATOMIC_RELAXED);
+  uintptr_t base = (uintptr_t) arena.base;
+  size_t start;
+
+  do
+    {
+      start = ((base + curr + align - 1) & ~((uintptr_t) align - 1))
+        - base;
+      if (start + len > arena.size)
+        return NULL;
+    }
+  while (!__atomic_compare_exchange_n (&arena.top, &curr, start + len,
+                                       TRUE, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED));
+
+  return arena.base + start;
+}
+
+/* `arena_allocator' alloc callback.  */
+static ptr_t
+arena_alloc (size_t len, size_t align)
+{
+  uint_t bin = arena_bin (len);
+  size_t size = ((size_t) 1) << bin;
+  ptr_t ptr = NULL;
+
+  if (arena.base == NULL)
+    return NULL;
+
+  /* Bumped blocks are aligned to their size up to ARENA_ALIGNMENT so
+     recycled blocks in a bin share the same alignment.  */
+  if (align <= ARENA_ALIGNMENT)
+    {
+      ptr = arena_pop (bin);
+      if (ptr == NULL)
+        ptr = arena_bump (size, size < ARENA_ALIGNMENT
+                          ? size : ARENA_ALIGNMENT);
+    }
+  else
+    ptr = arena_bump (size, align);
+
+  if (ptr != NULL)
+    __atomic_add_fetch (&arena.used, size, __ATOMIC_RELAXED);
+
+  return ptr;
+}
+
+/* `arena_allocator' free callback.  */
+static void
+arena_free (ptr_t ptr, size_t len)
+{
+  uint_t bin = arena_bin (len);
+  arena_push (bin, ptr);
+  __atomic_sub_fetch (&arena.used, ((size_t) 1) << bin,
+                      __ATOMIC_RELAXED);
+}
+
+/* `arena_allocator' realloc callback.  */
+static ptr_t
+arena_realloc (ptr_t ptr, size_t oldlen, size_t len)
+{
+  ptr_t moved;
+
+  if (arena_bin (len) == arena_bin (oldlen))
+    return ptr; /* Block is already large enough.  */
+
+  moved = arena_alloc (len, ARENA_GRAIN);
+  if (moved == NULL)
+    return NULL;
+
+  memcpy (moved, ptr, oldlen < len ? oldlen : len);
+  arena_free (ptr, oldlen);
+  return moved;
+}
+
+/* Arena allocator backend.  */
+static const allocator_t _arena_allocator = {
+  arena_alloc,
+  arena_realloc,
+  arena_free
+};
+
+const allocator_t *arena_allocator = &_arena_allocator;
+
+/* Reserve the arena for SIZE bytes and its allocation.  Called with
+   `arena_lock' held.  */
+static int_t
+arena_reserve (size_t size)
+{
+  ptr_t base = NULL;
+  const allocator_t *prev;
+  int_t err;
+
+  if (arena.base != NULL)
+    {
+      /* Share the arena if it's large enough.  */
+      if (size > arena.size)
+        return -EBUSY;
+      ++arena.users;
+      return 0;
+    }
+
+  size = (size + ARENA_PAGE_SIZE - 1) & ~((size_t) ARENA_PAGE_SIZE - 1);
+  if (posix_memalign (&base, ARENA_PAGE_SIZE, size) != 0)
+    return -ENOMEM;
+
+  memset (&arena, 0, sizeof (arena));
+  arena.base = (char *) base;
+  arena.size = size;
+  arena.users = 1;
+
+  prev = fz_get_allocator ();
+  err = fz_set_allocator (arena_allocator);
+  if (err < 0)
+    {
+      free (base);
+      memset (&arena, 0, sizeof (arena));
+      return err;
+    }
+  arena.prev = prev;
+
+  return 0;
+}
+
+/* Preallocate an arena of SIZE bytes and make it the backend of
+   subsequent fz_* allocations.  This is meant to be called before
+   rendering starts (i.e. at plugin activation) so the render thread
+   never has to enter the C library allocator.  The arena is process
+   wide, so reservations are counted and must each be balanced by a
+   call to `fz_arena_release'.  Later reservations share the arena and
+   fail with -EBUSY if it's smaller than SIZE.  Returns zero on success
+   or a negative error code.  */
+int_t
+fz_arena_reserve (size_t size)
+{
+  int_t err;
+
+  if (size == 0 || size / ARENA_GRAIN >= UINT32_MAX)
+    return -EINVAL;
+
+  pthread_mutex_lock (&arena_lock);
+  err = arena_reserve (size);
+  pthread_mutex_unlock (&arena_lock);
+  return err;
+}
+
+/* Free the arena and restore the previous backend.  Called with
+   `arena_lock' held once the arena has no users left.  */
+static int_t
+arena_release ()
+{
+  /* Give back deferred blocks and slabs that no longer hold any.  */
+  fz_collect ();
+  fz_slab_trim ();
+  if (__atomic_load_n (&arena.used, __ATOMIC_ACQUIRE) > 0)
+    return -EBUSY;
+
+  if (fz_get_allocator () == arena_allocator)
+    fz_set_allocator (arena.prev);
+
+  free (arena.base);
+  memset (&arena, 0, sizeof (arena));
+  return 0;
+}
+
+/* Balance a reservation made with `fz_arena_reserve'.  The arena is
+   freed and the previous backend restored when the last reservation
+   is released, which fails with -EBUSY if blocks are still in use.
+   The arena is kept until a later call succeeds in that case.
+   Returns 0 on success or a negative error code on error.  */
+int_t
+fz_arena_release ()
+{
+  int_t err = 0;
+
+  pthread_mutex_lock (&arena_lock);
+  if (arena.base == NULL)
+    err = -EINVAL;
+  else if (arena.users > 0 && --arena.users > 0)
+    err = 0; /* Still reserved by someone else.  */
+  else
+    err = arena_release ();
+  pthread_mutex_unlock (&arena_lock);
+  return err;
+}
+
+/* Pre-fault the whole arena, and lock it into memory if LOCK is
+   TRUE, so that blocks handed out later never page fault.  Returns 0
+   on success or a negative error code on error.  */
+int_t
+fz_arena_prefault (bool_t lock)
+{
+  if (arena.base == NULL)
+    return -EINVAL;
+  return fz_prefault (arena.base, arena.size, lock);
+}
+
+/* Get the total size of the arena in bytes.  */
+size_t
+fz_arena_size ()
+{
+  return arena.size;
+}
+
+/* Get the number of arena bytes currently handed out.  */
+size_t
+fz_arena_used ()
+{
+  return __atomic_load_n (&arena.used, __ATOMIC_RELAXED);
+}
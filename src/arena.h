@@ -0,0 +1,38 @@
+/* Header file for the preallocated arena allocator backend.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef FZ_ARENA_H
+#define FZ_ARENA_H 1
+
+#include "defs.h"
+#include "malloc.h"
+
+__BEGIN_DECLS
+
+extern int_t fz_arena_reserve (size_t);
+extern int_t fz_arena_release ();
+extern int_t fz_arena_prefault (bool_t);
+extern size_t fz_arena_size ();
+extern size_t fz_arena_used ();
+
+extern const allocator_t *arena_allocator;
+
+__END_DECLS
+
+#endif /* ! FZ_ARENA_H */
@@ -19,9 +19,254 @@
 
 #include <errno.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include "class.h"
 #include "malloc.h"
 
+#ifndef CLASS_POOLS_MAX
+# define CLASS_POOLS_MAX 16
+#endif
+
+/* Freelist of deleted instances of a class, see `fz_class_reserve'.
+   Class descriptors are constant, so pools are kept in a small table
+   that's searched by descriptor.  CAPACITY is the sum of all
+   reservations made for the class.  */
+struct class_pool_s
+{
+  const class_t *type;
+  ptr_t *free;
+  size_t nfree;
+  size_t capacity;
+};
+
+/* The table is shared by all threads and guarded by a spin lock,
+   since `fz_new' and `fz_del' may run in real-time threads.  Nothing
+   is allocated or freed while it is held.  Reservations are in turn
+   serialized by a mutex of their own.  */
+static struct class_pool_s class_pools[CLASS_POOLS_MAX];
+static size_t nclass_pools = 0;
+static bool_t class_pools_busy = FALSE;
+static pthread_mutex_t class_reserve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Take the lock of the pool table.  */
+static inline void
+class_lock ()
+{
+  while (__atomic_test_and_set (&class_pools_busy, __ATOMIC_ACQUIRE))
+    sched_yield ();
+}
+
+/* Release the lock taken with `class_lock'.  */
+static inline void
+class_unlock ()
+{
+  __atomic_clear (&class_pools_busy, __ATOMIC_RELEASE);
+}
+
+/* Find the pool of TYPE or return NULL if there's none.  Must be
+   called with the lock held.  */
+static inline struct class_pool_s *
+class_pool (const class_t *type)
+{
+  size_t i;
+  for (i = 0; i < nclass_pools; ++i)
+    if (class_pools[i].type == type)
+      return &class_pools[i];
+  return NULL;
+}
+
+/* Take a free object of TYPE from its pool, or return NULL if there's
+   none.  */
+static ptr_t
+class_pool_pop (const class_t *type)
+{
+  struct class_pool_s *pool;
+  ptr_t obj = NULL;
+
+  if (__atomic_load_n (&nclass_pools, __ATOMIC_RELAXED) == 0)
+    return NULL;
+
+  class_lock ();
+  pool = class_pool (type);
+  if (pool != NULL && pool->nfree > 0)
+    obj = pool->free[--pool->nfree];
+  class_unlock ();
+  return obj;
+}
+
+/* Put OBJ of TYPE in its pool if it has room.  Returns TRUE if OBJ was
+   taken.  */
+static bool_t
+class_pool_push (const class_t *type, ptr_t obj)
+{
+  struct class_pool_s *pool;
+  bool_t taken = FALSE;
+
+  if (__atomic_load_n (&nclass_pools, __ATOMIC_RELAXED) == 0)
+    return FALSE;
+
+  class_lock ();
+  pool = class_pool (type);
+  if (pool != NULL && pool->nfree < pool->capacity)
+    {
+      pool->free[pool->nfree++] = obj;
+      taken = TRUE;
+    }
+  class_unlock ();
+  return taken;
+}
+
+/* Get the number of free objects in the pool of TYPE.  */
+size_t
+fz_class_pooled (const class_t *type)
+{
+  struct class_pool_s *pool;
+  size_t nfree;
+
+  class_lock ();
+  pool = class_pool (type);
+  nfree = pool != NULL ? pool->nfree : 0;
+  class_unlock ();
+  return nfree;
+}
+
+/* Make NUM more deleted instances of TYPE go to its pool, which `fz_new'
+   takes instances from before allocating, and add NUM pre-faulted
+   objects to the pool.  Creating and deleting up to NUM instances at a
+   time then neither allocates nor frees memory.  Each reservation is
+   given back with `fz_class_release', so that independent users may
+   share a pool.  Pooled objects count as used memory.  Returns the
+   number of pooled objects or a negative error code on error.  */
+int_t
+fz_class_reserve (const class_t *type, size_t num)
+{
+  struct class_pool_s *pool;
+  ptr_t *free, *old = NULL;
+  size_t i, capacity;
+  int_t ret = 0;
+
+  if (type == NULL || type->size == 0)
+    return -EINVAL;
+  else if (num == 0)
+    return (int_t) fz_class_pooled (type);
+
+  /* Only reservations change the size of a pool, so it can be read
+     once and the objects allocated without holding the spin lock.  */
+  pthread_mutex_lock (&class_reserve_lock);
+  class_lock ();
+  pool = class_pool (type);
+  capacity = pool != NULL ? pool->capacity : 0;
+  if (pool == NULL && nclass_pools == CLASS_POOLS_MAX)
+    ret = -ENOSPC;
+  class_unlock ();
+
+  free = ret == 0 ? fz_malloc ((capacity + num) * sizeof (ptr_t)) : NULL;
+  if (ret == 0 && free == NULL)
+    ret = -ENOMEM;
+  for (i = 0; ret == 0 && i < num; ++i)
+    {
+      free[capacity + i] = fz_malloc (type->size);
+      if (free[capacity + i] == NULL)
+        ret = -ENOMEM;
+      else
+        fz_prefault (free[capacity + i], type->size, FALSE);
+    }
+
+  if (ret == 0)
+    {
+      class_lock ();
+      pool = class_pool (type);
+      if (pool == NULL)
+        {
+          pool = &class_pools[nclass_pools];
+          pool->type = type;
+          pool->free = NULL;
+          pool->nfree = 0;
+          pool->capacity = 0;
+          __atomic_store_n (&nclass_pools, nclass_pools + 1,
+                            __ATOMIC_RELAXED);
+        }
+      if (pool->nfree > 0)
+        memcpy (free, pool->free, pool->nfree * sizeof (ptr_t));
+      memmove (free + pool->nfree, free + capacity, num * sizeof (ptr_t));
+      old = pool->free;
+      pool->free = free;
+      pool->nfree += num;
+      pool->capacity += num;
+      ret = (int_t) pool->nfree;
+      class_unlock ();
+    }
+  else if (free != NULL)
+    {
+      while (i-- > 0)
+        fz_free (free[capacity + i]);
+      fz_free (free);
+    }
+  pthread_mutex_unlock (&class_reserve_lock);
+
+  fz_free (old);
+  return ret;
+}
+
+/* Give back NUM objects reserved for TYPE with `fz_class_reserve'.
+   Pooled objects beyond what remains reserved are freed, along with
+   the pool itself when nothing remains.  Returns the number of pooled
+   objects or a negative error code on error.  */
+int_t
+fz_class_release (const class_t *type, size_t num)
+{
+  struct class_pool_s *pool;
+  ptr_t *free = NULL;
+  ptr_t obj;
+  bool_t released = FALSE;
+  int_t ret = 0;
+
+  if (type == NULL)
+    return -EINVAL;
+
+  pthread_mutex_lock (&class_reserve_lock);
+  class_lock ();
+  pool = class_pool (type);
+  if (pool != NULL && num <= pool->capacity)
+    {
+      pool->capacity -= num;
+      released = TRUE;
+    }
+  else if (num > 0)
+    ret = -EINVAL;
+  class_unlock ();
+
+  /* Free the objects that don't fit anymore one at a time, so that the
+     spin lock is never held across `fz_free'.  */
+  while (released)
+    {
+      class_lock ();
+      pool = class_pool (type);
+      obj = pool->nfree > pool->capacity ? pool->free[--pool->nfree] : NULL;
+      if (obj == NULL && pool->capacity == 0)
+        {
+          /* Remove the pool, keeping the table dense.  */
+          free = pool->free;
+          *pool = class_pools[nclass_pools - 1];
+          __atomic_store_n (&nclass_pools, nclass_pools - 1,
+                            __ATOMIC_RELAXED);
+          pool = NULL;
+        }
+      class_unlock ();
+      if (obj == NULL)
+        {
+          ret = pool != NULL ? (int_t) fz_class_pooled (type) : 0;
+          break;
+        }
+      fz_free (obj);
+    }
+  pthread_mutex_unlock (&class_reserve_lock);
+
+  fz_free (free);
+  return ret;
+}
+
 /* Create an instance of the type represented by the TYPE descriptor.  */
 ptr_t
 fz_new (const class_t *type, ...)
@@ -29,17 +274,28 @@ fz_new (const class_t *type, ...)
   if (type == NULL)
     return NULL;
 
-  ptr_t obj = fz_malloc (type->size);
+  ptr_t obj = class_pool_pop (type);
+  bool_t pooled = obj != NULL;
+  if (!pooled)
+    obj = fz_malloc (type->size);
   if (obj == NULL)
     return NULL;
+  else if (pooled)
+    memset (obj, 0, type->size); /* Zeroed like blocks from `fz_malloc'.  */
 
   *((const class_t **) obj) = type;
   if (type->construct)
     {
+      ptr_t constructed;
       va_list ap;
       va_start (ap, type);
-      obj = type->construct (obj, &ap);
+      constructed = type->construct (obj, &ap);
       va_end (ap);
+      /* Constructors return NULL if they run out of memory.  */
+      if (constructed == NULL
+          && !(pooled && class_pool_push (type, obj)))
+        fz_free (obj);
+      obj = constructed;
     }
 
   return obj;
@@ -52,14 +308,22 @@ fz_del (ptr_t ptr)
   if (ptr == NULL)
     return -EINVAL;
 
+  const class_t *type = *((const class_t **) ptr);
+  int_t numref;
+
   /* Run the destructor if the memory is about to be freed.  */
-  if (fz_refcount (ptr) == 1)
-    {
-      ptr_t (*destructor) (ptr_t) = (*((const class_t **) ptr))->destruct;
-      if (destructor != NULL)
-        destructor (ptr);
-    }
+  if (__atomic_load_n (&nclass_pools, __ATOMIC_RELAXED) == 0)
+    return fz_release (ptr, type->destruct);
 
+  /* The class may be pooled, so take over the last reference rather
+     than freeing it, and keep the object if there's room.  */
+  numref = fz_unref (ptr);
+  if (numref != 0)
+    return numref;
+  if (type->destruct != NULL)
+    type->destruct (ptr);
+  if (class_pool_push (type, ptr))
+    return 0;
   return fz_free (ptr);
 }
 
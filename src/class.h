@@ -42,6 +42,9 @@ extern size_t fz_len (const ptr_t);
 extern ptr_t fz_clone (const ptr_t);
 extern int_t fz_cmp (const ptr_t, const ptr_t);
 extern bool_t fz_instance_of (const ptr_t, const class_t *);
+extern int_t fz_class_reserve (const class_t *, size_t);
+extern int_t fz_class_release (const class_t *, size_t);
+extern size_t fz_class_pooled (const class_t *);
 
 __END_DECLS
 
@@ -70,8 +70,15 @@ typedef bool _Bool;
 #define TRUE 1
 
 typedef int_t (*cmp_f) (const ptr_t, const ptr_t);
+typedef bool_t (*pred_f) (const ptr_t, ptr_t);
 
 /* Define error codes.  */
+#ifndef ENOMEM
+# define ENOMEM 12
+#endif
+#ifndef EBUSY
+# define EBUSY 16
+#endif
 #ifndef EINVAL
 # define EINVAL 22
 #endif
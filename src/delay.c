@@ -17,6 +17,7 @@
    along with libfreeztile; see the file COPYING.  If not see
    <http://www.gnu.org/licenses/>.  */
 
+#include <string.h>
 #include "delay.h"
 #include "node.h"
 #include "private-node.h"
@@ -30,7 +31,10 @@ typedef struct delay_s
   real_t delay;
 } delay_t;
 
-/* Voice state struct for storing delayed samples.  */
+/* Voice state struct for storing delayed samples.  The ring buffer
+   always holds a power of two samples, at least DELAY_TIME_MAX
+   seconds, so changing the delay time only moves the read position
+   relative to BUFPOS, where the next sample is written.  */
 struct state_s
 {
   list_t *ringbuf;
@@ -44,10 +48,11 @@ delay_state_init (node_t *node, voice_t *voice, ptr_t state)
   (void) node;
   (void) voice;
   struct state_s *_state = (struct state_s *) state;
-  _state->ringbuf = fz_new_simple_vector (real_t);
+  _state->ringbuf = fz_new_ringbuf (real_t, LISTOPT_NONE);
   _state->bufpos = 0;
-  fz_clear (_state->ringbuf,
-            (size_t) (fz_get_sample_rate () * DELAY_TIME_MAX));
+  if (fz_reserve (_state->ringbuf,
+                  (size_t) (fz_get_sample_rate () * DELAY_TIME_MAX)) > 0)
+    fz_resize (_state->ringbuf, fz_capacity (_state->ringbuf));
 }
 
 /* State cleanup callback.  */
@@ -59,39 +64,35 @@ delay_state_free (node_t *node, voice_t *voice, ptr_t state)
   fz_del (((struct state_s *) state)->ringbuf);
 }
 
-/* Aquire state instance for given VOICE and LENGTH.  */
-static struct state_s *
-get_voice_state (node_t *node, const voice_t *voice, size_t length)
+/* State reset callback.  Silences the delay line without
+   reallocating it.  */
+static void
+delay_state_reset (node_t *node, voice_t *voice, ptr_t state)
 {
-  size_t curlen;
-  uint_t diff;
-  struct state_s *state = fz_node_state (node, voice);
-  if (!state)
-    return NULL;
-
-  curlen = fz_len (state->ringbuf);
-  if (length > curlen)
-    {
-      /* Grow delay buffer.  */
-      diff = length - curlen;
-      fz_insert (state->ringbuf, state->bufpos, diff, NULL);
-      state->bufpos = (state->bufpos + diff) % length;
-    }
-  else if (length < curlen)
+  (void) node;
+  (void) voice;
+  struct state_s *_state = (struct state_s *) state;
+  size_t len = fz_len (_state->ringbuf);
+  size_t nspan;
+  uint_t i;
+  real_t *span;
+
+  for (i = 0; i < len; i += nspan)
     {
-      /* Shrink delay buffer.  */
-      diff = curlen - length;
-      if (diff > state->bufpos)
-        {
-          diff -= state->bufpos;
-          fz_erase (state->ringbuf, curlen - diff, diff);
-          diff = state->bufpos;
-        }
-      state->bufpos -= diff;
-      fz_erase (state->ringbuf, state->bufpos, diff);
+      span = fz_ringbuf_span (_state->ringbuf, i, &nspan);
+      if (span == NULL)
+        break;
+      memset (span, 0, nspan * sizeof (real_t));
     }
+  _state->bufpos = 0;
+}
 
-  return state;
+/* State pre-fault callback.  */
+static int_t
+delay_state_prefault (node_t *node, ptr_t state, bool_t lock)
+{
+  (void) node;
+  return fz_list_prefault (((struct state_s *) state)->ringbuf, lock);
 }
 
 /* Delay node renderer.  */
@@ -102,27 +103,47 @@ delay_render (node_t *node, list_t *frames, const voice_t *voice)
   struct state_s *state;
   real_t *framedata = fz_list_data (frames);
   size_t nframes = fz_len (frames);
-  real_t *buffer;
-  size_t buflen;
-  uint_t i;
-  real_t in;
+  real_t *rbuf, *wbuf;
+  size_t buflen, ringlen;
+  size_t nread, nwrite, nspan;
+  uint_t i, j;
+  real_t in, out;
 
   buflen = (size_t) (fz_get_sample_rate () * delay->delay);
   if (buflen == 0)
     return nframes;
 
-  state = get_voice_state (node, voice, buflen);
+  state = fz_node_state (node, voice);
   if (state == NULL)
-    return 0;
-
-  buffer = fz_list_data (state->ringbuf);
-  for (i = 0; i < nframes; ++i)
+    return voice == NULL ? 0 : -ENOMEM;
+
+  ringlen = fz_len (state->ringbuf);
+  if (ringlen == 0)
+    return -ENOMEM;
+  else if (buflen > ringlen)
+    buflen = ringlen;
+
+  /* Process the frames in spans where both the read and the write
+     position are contiguous in the ring buffer.  A span never exceeds
+     BUFLEN so it won't read samples written in the same span.  */
+  for (i = 0; i < nframes; i += nspan)
     {
-      in = framedata[i];
-      framedata[i] += delay->gain * buffer[state->bufpos];
-      buffer[state->bufpos] = in + (delay->feedback
-                                    * buffer[state->bufpos]);
-      state->bufpos = (state->bufpos + 1) % buflen;
+      wbuf = fz_ringbuf_span (state->ringbuf, state->bufpos, &nwrite);
+      rbuf = fz_ringbuf_span (state->ringbuf,
+                              (state->bufpos + ringlen - buflen)
+                              & (ringlen - 1), &nread);
+      nspan = nframes - i;
+      nspan = nspan < nwrite ? nspan : nwrite;
+      nspan = nspan < nread ? nspan : nread;
+      nspan = nspan < buflen ? nspan : buflen;
+      for (j = 0; j < nspan; ++j)
+        {
+          in = framedata[i + j];
+          out = rbuf[j];
+          framedata[i + j] += delay->gain * out;
+          wbuf[j] = in + (delay->feedback * out);
+        }
+      state->bufpos = (state->bufpos + nspan) & (ringlen - 1);
     }
 
   return nframes;
@@ -137,6 +158,8 @@ delay_constructor (ptr_t ptr, va_list *args)
   self->__parent.state_size = sizeof (struct state_s);
   self->__parent.state_init = delay_state_init;
   self->__parent.state_free = delay_state_free;
+  self->__parent.state_reset = delay_state_reset;
+  self->__parent.state_prefault = delay_state_prefault;
   self->__parent.render = delay_render;
   self->feedback = 0;
   self->gain = 0;
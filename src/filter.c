@@ -17,7 +17,6 @@
    along with libfreeztile; see the file COPYING.  If not see
    <http://www.gnu.org/licenses/>.  */
 
-#include <string.h>
 #include "filter.h"
 #include "node.h"
 #include "private-node.h"
@@ -39,10 +38,9 @@ struct state_s
   real_t b2;
   real_t b3;
   real_t b4;
+  bool_t primed; /* FALSE until the first frame has been filtered.  */
 };
 
-static const struct state_s zero_state = {0, 0, 0, 0, 0};
-
 /* Filter node renderer.  */
 static int_t
 filter_render (node_t *node, list_t *frames, const voice_t *voice)
@@ -60,7 +58,7 @@ filter_render (node_t *node, list_t *frames, const voice_t *voice)
 
   state = fz_node_state (node, voice);
   if (state == NULL)
-    return 0;
+    return voice == NULL ? 0 : -ENOMEM;
 
   real_t in,
     t1,
@@ -70,12 +68,13 @@ filter_render (node_t *node, list_t *frames, const voice_t *voice)
     b2 = state->b2,
     b3 = state->b3,
     b4 = state->b4;
-  if (memcmp (state, &zero_state, sizeof (struct state_s)) == 0)
+  if (!state->primed)
     {
-      /* First call for given voice, initialize coefficients.  */
+      /* New or reset state, initialize coefficients.  */
       i = 1;
       b0 = framedata[0];
       b1 = b2 = b3 = b4 = 0;
+      state->primed = TRUE;
     }
 
   for (; i < nframes; ++i)
@@ -23,6 +23,7 @@
 #include "node.h"
 #include "private-node.h"
 #include "list.h"
+#include "private-list.h"
 
 #define SHAPE_SIZE 4096
 #define TWO_PI 6.28318530718
@@ -52,10 +53,10 @@ form_render (node_t *node, list_t *frames, const voice_t *voice)
 {
   form_t *form = (form_t *) node;
   uint_t i = 0;
-  size_t nframes = fz_len (frames);
-  real_t *framedata = fz_list_data (frames);
-  real_t *formdata = fz_list_data (form->shape);
-  size_t period = fz_len (form->shape);
+  size_t nframes = real_vector_len (frames);
+  real_t *framedata = real_vector_data (frames);
+  const real_t *formdata = real_vector_data (form->shape);
+  size_t period = real_vector_len (form->shape);
   real_t rate = fz_get_sample_rate ();
   real_t pos;
   real_t shift;
@@ -70,13 +71,16 @@ form_render (node_t *node, list_t *frames, const voice_t *voice)
   real_t *fmodarg;
   const real_t *fmoddata;
 
-  if (period == 0 || !voice)
+  if (period == 0)
     return 0;
 
+  state = fz_node_state (node, voice);
+  if (state == NULL)
+    return voice == NULL ? 0 : -ENOMEM;
+
   freq = fz_voice_frequency (voice)
     * pow (TWELFTH_ROOT_OF_TWO, form->pitch);
-  state = fz_node_state (node, voice);
-  if (freq <= 0 || state == NULL)
+  if (freq <= 0)
     return 0;
 
   /* Calculate delta frequency (portamento).  */
@@ -165,7 +169,7 @@ form_constructor (ptr_t ptr, va_list *args)
 
   self->__parent.state_size = sizeof (struct state_s);
   self->__parent.render = form_render;
-  self->shape = fz_new_simple_vector (real_t);
+  self->shape = fz_new_aligned_vector (real_t);
   self->shifting = 0.5;
   self->portamento = 0;
   self->pitch = 0;
@@ -191,33 +195,33 @@ fz_form_set_shape (form_t *form, int_t shape)
   uint_t i;
   size_t shape_size;
   uint_t offset; /* Used to align triangle with sine and square.  */
+  real_t *data;
 
   if (form == NULL)
     return -EINVAL;
 
   shape_size = (shape == SHAPE_SQUARE) ? 2 : SHAPE_SIZE;
-  fz_clear (form->shape, shape_size);
+  if (fz_clear (form->shape, shape_size) < 0)
+    return -ENOMEM;
+  data = real_vector_data (form->shape);
 
   switch (shape)
     {
     case SHAPE_SINE:
       for (i = 0; i < shape_size; ++i)
-        fz_val_at (form->shape, i, real_t)
-          = sin (TWO_PI * ((real_t) i) / shape_size);
+        data[i] = sin (TWO_PI * ((real_t) i) / shape_size);
       break;
     case SHAPE_TRIANGLE:
       for (i = 0; i < shape_size; ++i)
         {
           offset = ((i - (shape_size / 4)) + shape_size) % shape_size;
-          fz_val_at (form->shape, i, real_t)
-            = (fabs ((((real_t) offset * 4) / shape_size) - 2) - 1);
+          data[i] = (fabs ((((real_t) offset * 4) / shape_size) - 2) - 1);
         }
       break;
     case SHAPE_SQUARE:
       for (i = 0; i < shape_size; ++i)
-        fz_val_at (form->shape, i, real_t)
-          = i < (shape_size / 2) ? 1 : -1;
-          break;
+        data[i] = i < (shape_size / 2) ? 1 : -1;
+      break;
     default:
       return -EINVAL;
     }
@@ -20,12 +20,19 @@
 #include <errno.h>
 #include "graph.h"
 #include "list.h"
+#include "private-list.h"
+#include "malloc.h"
 #include "node.h"
 #include "mod.h"
 
 #define GRAPH_NODE_NONE 0
 #define GRAPH_NODE_RENDERED (1 << 0)
 
+/* Typed accessors for the node, modulator and list vectors.  */
+FZ_VECTOR_DEFINE (node_vector, node_t *)
+FZ_VECTOR_DEFINE (mod_vector, mod_t *)
+FZ_VECTOR_DEFINE (list_vector, list_t *)
+
 /* Graph class struct.  */
 typedef struct graph_s
 {
@@ -43,11 +50,11 @@ graph_constructor (ptr_t ptr, va_list *args)
 {
   graph_t *self = (graph_t *) ptr;
   (void) args;
-  self->nodes = fz_new_retaining_vector (node_t *);
-  self->mods = fz_new_retaining_vector (mod_t *);
+  self->nodes = fz_new_vector (node_t *, LISTOPT_KEEP | LISTOPT_INDEX);
+  self->mods = fz_new_vector (mod_t *, LISTOPT_KEEP | LISTOPT_INDEX);
   self->am = fz_new_owning_vector (list_t *);
   self->buffers = fz_new_owning_vector (list_t *);
-  self->flags = fz_new_simple_vector (flags_t);
+  self->flags = fz_new_small_vector (flags_t, LISTOPT_NONE);
   return self;
 }
 
@@ -83,23 +90,6 @@ graph_node_edges (const graph_t *graph, const node_t *node)
     : NULL;
 }
 
-/* Check if NODE is a sink in GRAPH.  */
-static bool_t
-graph_node_is_sink (const graph_t *graph, const node_t *node)
-{
-  const list_t *edges = graph_node_edges (graph, node);
-  if (edges == NULL)
-    return FALSE; /* NODE is not part of GRAPH.  */
-
-  uint_t index;
-  size_t nedges = fz_len ((const ptr_t) edges);
-  for (index = 0; index < nedges; ++index)
-    if (fz_val_at (edges, index, real_t) >= 0)
-      return FALSE; /* NODE has at least 1 outgoing edge.  */
-
-  return TRUE;
-}
-
 /* Get pointer to edge connecting SOURCE with SINK in GRAPH.  */
 static real_t *
 graph_edge_ptr (const graph_t *graph, const node_t *source,
@@ -187,7 +177,8 @@ fz_graph_add_node (graph_t *graph, node_t *node)
   for (y = 0; y <= index; ++y)
     {
       if (y >= h)
-        fz_push_one (graph->am, fz_new_simple_vector (real_t));
+        fz_push_one (graph->am, fz_new_small_vector (real_t,
+                                                     LISTOPT_NONE));
       edges = fz_ref_at (graph->am, y, list_t);
       w = fz_len (edges);
       for (x = w; x <= index; ++x)
@@ -198,7 +189,7 @@ fz_graph_add_node (graph_t *graph, node_t *node)
 
   /* Add a frame buffer and flags for NODE.  */
   flags_t noflags = GRAPH_NODE_NONE;
-  fz_push_one (graph->buffers, fz_new_simple_vector (real_t));
+  fz_push_one (graph->buffers, fz_new_aligned_vector (real_t));
   fz_push_one (graph->flags, &noflags);
 
   return 0;
@@ -282,6 +273,52 @@ fz_graph_buffer (const graph_t *graph, const node_t *node)
   return fz_ref_at (graph->buffers, index, list_t);
 }
 
+/* Allocate and pre-fault everything GRAPH needs to render up to
+   NFRAMES frames with any of VOICES: frame buffers, modulator buffers
+   and node and modulator states.  Memory is locked if LOCK is TRUE.
+   Call this outside of the render thread, after the graph is set up,
+   so that rendering doesn't allocate or page fault.  VOICES should be
+   every voice that will be rendered, such as `fz_vpool_all_voices'
+   of a voice pool, whether pressed or not.  Returns 0 on
+   success or a negative error code on error.  */
+int_t
+fz_graph_reserve (graph_t *graph, const list_t *voices, size_t nframes,
+                  bool_t lock)
+{
+  uint_t i, v;
+  int_t err;
+  size_t nnodes, nmods;
+  size_t nvoices = fz_len ((const ptr_t) voices);
+
+  if (graph == NULL)
+    return -EINVAL;
+
+  fz_clear (graph->mods, 0);
+  nnodes = fz_len (graph->nodes);
+  for (i = 0; i < nnodes; ++i)
+    {
+      node_t *node = fz_ref_at (graph->nodes, i, node_t);
+      list_t *buffer = fz_ref_at (graph->buffers, i, list_t);
+      if ((err = fz_reserve (buffer, nframes)) < 0
+          || (err = fz_list_prefault (buffer, lock)) < 0
+          || (err = fz_node_collect_mods (node, graph->mods)) != 0)
+        return err < 0 ? err : -err;
+
+      for (v = 0; v < nvoices; ++v)
+        if ((err = fz_node_reserve (node, fz_ref_at (voices, v, voice_t),
+                                    lock)) < 0)
+          return err;
+    }
+
+  nmods = fz_len (graph->mods);
+  for (i = 0; i < nmods; ++i)
+    if ((err = fz_mod_reserve (fz_ref_at (graph->mods, i, mod_t), nframes,
+                               voices, lock)) < 0)
+      return err;
+
+  return 0;
+}
+
 /* Prepare GRAPH to render NFRAMES frames.  */
 uint_t
 fz_graph_prepare (graph_t *graph, size_t nframes)
@@ -289,6 +326,7 @@ fz_graph_prepare (graph_t *graph, size_t nframes)
   if (graph == NULL)
     return EINVAL;
 
+  fz_rt_enter ();
   fz_clear (graph->mods, 0);
 
   uint_t i;
@@ -298,7 +336,10 @@ fz_graph_prepare (graph_t *graph, size_t nframes)
       node_t *node = fz_ref_at (graph->nodes, i, node_t);
       fz_node_prepare (node, nframes);
       fz_node_collect_mods (node, graph->mods);
-      fz_clear (fz_ref_at (graph->buffers, i, list_t), nframes);
+      /* Sources are mixed into the buffer so it has to be zeroed.  */
+      list_t *buffer = list_vector_at (graph->buffers, i);
+      fz_resize (buffer, nframes);
+      fz_zero (buffer);
       fz_val_at (graph->flags, i, flags_t) &= ~GRAPH_NODE_RENDERED;
     }
 
@@ -306,85 +347,118 @@ fz_graph_prepare (graph_t *graph, size_t nframes)
   for (i = 0; i < nmods; ++i)
     fz_mod_prepare (fz_ref_at (graph->mods, i, mod_t), nframes);
 
+  fz_rt_leave ();
   return 0;
 }
 
-/* Render NODE into internal buffer of GRAPH using VOICE.  */
+/* Check if the node at INDEX is a sink in GRAPH.  */
+static bool_t
+graph_index_is_sink (const graph_t *graph, uint_t index)
+{
+  const list_t *edges = list_vector_at (graph->am, index);
+  const real_t *weights = real_vector_data (edges);
+  size_t nedges = real_vector_len (edges);
+  uint_t i;
+  for (i = 0; i < nedges; ++i)
+    if (weights[i] >= 0)
+      return FALSE; /* NODE has at least 1 outgoing edge.  */
+
+  return TRUE;
+}
+
+/* Render the node at INDEX into internal buffer of GRAPH using
+   VOICE.  Nodes, buffers and edges are addressed by index so the
+   render path never has to search for a node or dispatch through the
+   list class.  */
 static int_t
-graph_node_render (graph_t *graph, node_t *node,
-                   const voice_t *voice)
+graph_node_render (graph_t *graph, uint_t index, const voice_t *voice)
 {
   int_t err;
-  int_t index = graph_node_index (graph, node);
-  flags_t *flags = fz_ref_at (graph->flags, index, flags_t);
-  list_t *buffer = fz_ref_at (graph->buffers, index, list_t);
+  flags_t *flags = fz_vector_ref_at (graph->flags, index, flags_t);
+  list_t *buffer = list_vector_at (graph->buffers, index);
   if (*flags & GRAPH_NODE_RENDERED)
-    return fz_len (buffer); /* NODE has already been rendered.  */
+    return real_vector_len (buffer); /* Node has already been rendered.  */
 
-  /* Mix source outputs into NODEs buffer.  */
-  real_t *frames = fz_list_data (buffer);
-  size_t nframes = fz_len (buffer);
+  /* Mix source outputs into the nodes buffer.  */
+  list_t *const *buffers = list_vector_data (graph->buffers);
+  list_t *const *am = list_vector_data (graph->am);
+  real_t *frames = real_vector_data (buffer);
+  size_t nframes = real_vector_len (buffer);
   uint_t srcidx;
-  size_t nnodes = fz_len (graph->nodes);
+  size_t nnodes = node_vector_len (graph->nodes);
   for (srcidx = 0; srcidx < nnodes; ++srcidx)
     {
-      if (srcidx == (uint_t) index)
+      if (srcidx == index)
         continue;
 
-      node_t *source = fz_ref_at (graph->nodes, srcidx, node_t);
-      real_t *mix = graph_edge_ptr (graph, source, node);
-      if (mix == NULL || *mix <= 0)
+      real_t mix = real_vector_at (am[srcidx], index);
+      if (mix <= 0)
         continue; /* SOURCE is not a source of NODE (or MIX = 0).  */
 
       /* Render SOURCE.  */
-      err = graph_node_render (graph, source, voice);
+      err = graph_node_render (graph, srcidx, voice);
       if (err < 0)
         return err; /* Relay failed render.  */
 
       uint_t frame;
       size_t nsrcframes = (size_t) err < nframes
         ? (size_t) err : nframes;
-      real_t *srcframes = fz_list_data (fz_ref_at (graph->buffers,
-                                                   srcidx, list_t));
+      const real_t *srcframes = real_vector_data (buffers[srcidx]);
       for (frame = 0; frame < nsrcframes; ++frame)
-        frames[frame] += srcframes[frame] * *mix;
+        frames[frame] += srcframes[frame] * mix;
     }
 
   /* Render NODE.  */
-  err = fz_node_render (node, buffer, voice);
+  err = fz_node_render (node_vector_at (graph->nodes, index), buffer,
+                        voice);
   if (err >= 0)
     *flags |= GRAPH_NODE_RENDERED;
 
   return err;
 }
 
-/* Render GRAPH using VOICE.  */
+/* Render GRAPH using VOICE.  Returns the number of rendered frames or
+   a negative error code, -ENOMEM if a node or modulator failed to
+   allocate a state for VOICE.  */
 int_t
 fz_graph_render (graph_t *graph, const voice_t *voice)
 {
   if (graph == NULL)
     return -EINVAL;
 
+  fz_rt_enter ();
+
   uint_t index;
-  size_t nmods = fz_len (graph->mods);
+  int_t nrendered = 0;
+  mod_t *const *mods = mod_vector_data (graph->mods);
+  size_t nmods = mod_vector_len (graph->mods);
   for (index = 0; index < nmods; ++index)
-    fz_mod_render (fz_ref_at (graph->mods, index, mod_t), voice);
+    if (fz_mod_render (mods[index], voice) == -ENOMEM)
+      nrendered = -ENOMEM;
 
-  int_t nrendered = 0;
-  size_t nnodes = fz_len (graph->nodes);
+  if (nrendered < 0)
+    {
+      fz_rt_leave ();
+      return nrendered;
+    }
+
+  size_t nnodes = node_vector_len (graph->nodes);
   for (index = 0; index < nnodes; ++index)
     {
-      node_t *node = fz_ref_at (graph->nodes, index, node_t);
-      if (graph_node_is_sink (graph, node))
+      if (graph_index_is_sink (graph, index))
         {
-          int_t err = graph_node_render (graph, node, voice);
+          int_t err = graph_node_render (graph, index, voice);
           if (err <= 0)
-            return err;
+            {
+              nrendered = err;
+              break;
+            }
           else if (err < nrendered || nrendered == 0)
             nrendered = err;
         }
     }
 
+  fz_rt_leave ();
   return nrendered;
 }
 
@@ -37,6 +37,7 @@ extern uint_t fz_graph_connect (graph_t *, const node_t *,
                                 const node_t *);
 extern const list_t * fz_graph_buffer (const graph_t *,
                                        const node_t *);
+extern int_t fz_graph_reserve (graph_t *, const list_t *, size_t, bool_t);
 extern uint_t fz_graph_prepare (graph_t *, size_t);
 extern int_t fz_graph_render (graph_t *, const voice_t *);
 
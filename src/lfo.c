@@ -46,8 +46,7 @@ lfo_render (mod_t *mod, const voice_t *voice)
   int_t i;
 
   if (voiceref == NULL)
-    /* Probably because `voice' is NULL.  */
-    return -EINVAL;
+    return voice == NULL ? -EINVAL : -ENOMEM;
 
   if (self->freq <= 0)
     {
@@ -62,10 +61,16 @@ lfo_render (mod_t *mod, const voice_t *voice)
     }
 
   if (*voiceref == NULL)
-    *voiceref = fz_new (voice_c);
+    {
+      *voiceref = fz_new (voice_c);
+      if (*voiceref == NULL)
+        return -ENOMEM;
+    }
   else
     fz_voice_release (*voiceref);
 
+  /* Forms add to what's in the buffer.  */
+  fz_zero (mod->stepbuf);
   fz_voice_press (*voiceref, self->freq, 1);
   nrendered = fz_node_render ((node_t *) self->form,
                               mod->stepbuf,
@@ -90,6 +95,15 @@ lfo_freestate (mod_t *mod, ptr_t voiceref)
     fz_del (voice);
 }
 
+/* `resetstate' callback.  The helper voice is kept so that the LFO
+   runs freely across notes and resetting doesn't allocate.  */
+static void
+lfo_resetstate (mod_t *mod, ptr_t voiceref)
+{
+  (void) mod;
+  fz_voice_release (*((voice_t **) voiceref));
+}
+
 /* LFO constructor.  */
 static ptr_t
 lfo_constructor (ptr_t ptr, va_list *args)
@@ -100,7 +114,9 @@ lfo_constructor (ptr_t ptr, va_list *args)
   real_t freq = va_arg (*args, real_t);
 
   self->__parent.render = lfo_render;
+  self->__parent.state_size = sizeof (voice_t *);
   self->__parent.freestate = lfo_freestate;
+  self->__parent.resetstate = lfo_resetstate;
   self->form = fz_new (form_c, shape);
   self->freq = freq;
 
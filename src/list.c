@@ -18,25 +18,15 @@
    <http://www.gnu.org/licenses/>.  */
 
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include "list.h"
+#include "private-list.h"
 #include "defs.h"
+#include "sort.h"
 #include "malloc.h"
 #include "class.h"
 
-/* Abstract list class struct.  */
-struct list_s
-{
-  const class_t *__class;
-  size_t type_size;
-  char *type_name;
-  flags_t flags;
-  int_t (*insert) (list_t *, uint_t, uint_t, ptr_t);
-  int_t (*erase) (list_t *, uint_t, uint_t);
-  ptr_t (*at) (const list_t *, uint_t);
-  int_t (*sort) (list_t *, cmp_f);
-};
-
 /* Abstract list constuctor.  */
 static ptr_t
 list_constructor (ptr_t ptr, va_list *args)
@@ -48,6 +38,8 @@ list_constructor (ptr_t ptr, va_list *args)
 
   self->type_name = (char *) fz_malloc (sizeof (char) *
                                         (strlen (type_name) + 1));
+  if (self->type_name == NULL)
+    return NULL;
   strcpy (self->type_name, type_name);
   self->type_size = type_size;
   self->flags = flags;
@@ -55,6 +47,9 @@ list_constructor (ptr_t ptr, va_list *args)
   self->erase = NULL;
   self->at = NULL;
   self->sort = NULL;
+  self->reserve = NULL;
+  self->capacity = NULL;
+  self->shrink = NULL;
 
   return self;
 }
@@ -67,8 +62,9 @@ list_destructor (ptr_t ptr)
   uint_t i;
   size_t len;
 
-  if ((self->flags & LISTOPT_KEEP) == LISTOPT_KEEP
-      || (self->flags & LISTOPT_PASS) == LISTOPT_PASS)
+  if ((~self->flags & LISTOPT_VIEW)
+      && ((self->flags & LISTOPT_KEEP) == LISTOPT_KEEP
+          || (self->flags & LISTOPT_PASS) == LISTOPT_PASS))
     {
       len = fz_len (self);
       for (i = 0; i < len; ++i)
@@ -164,6 +160,176 @@ fz_clear (list_t *list, size_t size)
   return (int_t) size;
 }
 
+/* Resize LIST to SIZE items.  Unlike `fz_clear' the items that are
+   kept are not reinitialized, only items appended to LIST are zeroed,
+   so resizing a buffer to the length it already has costs nothing.
+   Returns SIZE or a negative error code on error.  */
+int_t
+fz_resize (list_t *list, size_t size)
+{
+  int_t err;
+  size_t len = fz_len (list);
+
+  if (list == NULL)
+    return -EINVAL;
+
+  if (size < len)
+    err = fz_erase (list, size, len - size);
+  else if (size > len)
+    err = fz_insert (list, len, size - len, NULL);
+  else
+    err = 0;
+
+  return err < 0 ? err : (int_t) size;
+}
+
+/* Set all items in vector LIST to zero.  Vectors of pointers are not
+   accepted since LIST could own the items.  Returns the number of
+   zeroed items or a negative error code on error.  */
+int_t
+fz_zero (list_t *list)
+{
+  vector_t *self = (vector_t *) list;
+
+  if (!fz_is_vector (list) || (list->flags & LISTOPT_PTRS))
+    return -EINVAL;
+
+  if (self->length > 0)
+    memset (self->items, 0, self->length * list->type_size);
+
+  return (int_t) self->length;
+}
+
+/* Make sure LIST can hold at least SIZE items without reallocating.
+   Returns the resulting capacity or a negative error code on error.  */
+int_t
+fz_reserve (list_t *list, size_t size)
+{
+  if (list == NULL)
+    return -EINVAL;
+  else if (list->reserve == NULL)
+    return -ENOSYS; /* Not implemented.  */
+  return list->reserve (list, size);
+}
+
+/* Get the number of items LIST can hold without reallocating.  */
+size_t
+fz_capacity (const list_t *list)
+{
+  if (list == NULL)
+    return 0;
+  else if (list->capacity == NULL)
+    return fz_len ((const ptr_t) list);
+  return list->capacity (list);
+}
+
+/* Release space in LIST not used by its items.  Returns 0 on success or
+   a negative error code on error.  */
+int_t
+fz_shrink_to_fit (list_t *list)
+{
+  if (list == NULL)
+    return -EINVAL;
+  else if (list->shrink == NULL)
+    return -ENOSYS; /* Not implemented.  */
+  return list->shrink (list);
+}
+
+/* Slot in the pointer index of a LISTOPT_INDEX vector.  */
+struct vector_slot_s
+{
+  ptr_t key;
+  uint_t pos;
+};
+
+/* Get the first slot to probe for KEY in vector SELF.  */
+static inline size_t
+vector_index_hash (const vector_t *self, const ptr_t key)
+{
+  /* Pointers to slab blocks are spaced by powers of two, so all bits
+     are mixed into the low bits used for the slot number.  */
+  uint64_t hash = (uint64_t) (uintptr_t) key;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return (size_t) hash & (self->nslots - 1);
+}
+
+/* Add KEY at POS to the index of SELF unless KEY is already indexed,
+   since `fz_index_of' returns the first position of a pointer.  */
+static void
+vector_index_put (vector_t *self, const ptr_t key, uint_t pos)
+{
+  size_t slot = vector_index_hash (self, key);
+  while (self->slots[slot].key != NULL)
+    {
+      if (self->slots[slot].key == key)
+        return;
+      slot = (slot + 1) & (self->nslots - 1);
+    }
+  self->slots[slot].key = key;
+  self->slots[slot].pos = pos;
+}
+
+/* Rebuild the index of SELF, if it has one, from its items.  This is
+   done by every call that moves items, so that lookups never write
+   and may run concurrently.  */
+static void
+vector_index_update (vector_t *self)
+{
+  const ptr_t *items = (const ptr_t *) self->items;
+  uint_t i;
+
+  if (self->nslots == 0)
+    return;
+
+  memset (self->slots, 0, self->nslots * sizeof (struct vector_slot_s));
+  for (i = 0; i < self->length; ++i)
+    vector_index_put (self, items[i], i);
+}
+
+/* Look up the first position of KEY in the index of vector LIST.
+   Returns -1 if KEY is not in LIST.  */
+static int_t
+vector_index_get (const list_t *list, const ptr_t key)
+{
+  const vector_t *self = (const vector_t *) list;
+  size_t slot;
+
+  slot = vector_index_hash (self, key);
+  while (self->slots[slot].key != NULL)
+    {
+      if (self->slots[slot].key == key)
+        return (int_t) self->slots[slot].pos;
+      slot = (slot + 1) & (self->nslots - 1);
+    }
+
+  return -1;
+}
+
+/* Resize the index of vector LIST to fit its capacity with a load
+   factor of at most 1/2.  If that fails the index is dropped and
+   `fz_index_of' falls back to a linear search.  */
+static void
+vector_index_resize (list_t *list)
+{
+  vector_t *self = (vector_t *) list;
+  size_t nslots = 1;
+
+  fz_free (self->slots);
+  self->slots = NULL;
+  self->nslots = 0;
+  if (self->capacity == 0)
+    return;
+
+  while (nslots < self->capacity * 2)
+    nslots <<= 1;
+  self->slots = fz_malloc (nslots * sizeof (struct vector_slot_s));
+  if (self->slots != NULL)
+    self->nslots = nslots;
+  vector_index_update (self);
+}
+
 /* Find the first occurance of ITEM in LIST.  */
 int_t
 fz_index_of (const list_t *list, const ptr_t item, cmp_f compare)
@@ -177,6 +343,10 @@ fz_index_of (const list_t *list, const ptr_t item, cmp_f compare)
   if (compare == NULL)
     compare = fz_cmp_ptr;
 
+  if (compare == fz_cmp_ptr && item != NULL && fz_is_vector (list)
+      && ((const vector_t *) list)->nslots > 0)
+    return vector_index_get (list, item);
+
   len = fz_len ((const ptr_t) list);
   for (i = 0; i < len; ++i)
     if (compare (fz_at (list, i), item) == 0)
@@ -200,6 +370,202 @@ fz_sort (list_t *list, cmp_f compare)
   return list->sort (list, compare);
 }
 
+/* Swap the SIZE byte items at A and B.  */
+static inline void
+list_swap (char *a, char *b, size_t size)
+{
+  char tmp;
+  for (; size > 0; --size, ++a, ++b)
+    tmp = *a, *a = *b, *b = tmp;
+}
+
+FZ_SORT_DEFINE (sort_int, int_t, FZ_SORT_LESS)
+FZ_SORT_DEFINE (sort_real, real_t, FZ_SORT_LESS)
+
+/* Sort the N items at ITEMS of LIST using COMPARE.  The comparators
+   of this file get a sort specialized for their type, which doesn't
+   have to call COMPARE at all.  Other short arrays are insertion
+   sorted and the rest are left to `qsort'.  */
+static void
+list_sort_items (const list_t *list, char *items, size_t n,
+                 cmp_f compare)
+{
+  size_t size = list->type_size;
+  size_t i, j;
+
+  /* For pointer lists COMPARE gets pointers to the item pointers.  */
+  if ((~list->flags & LISTOPT_PTRS) && compare == fz_cmp_real
+      && size == sizeof (real_t))
+    sort_real_sort ((real_t *) items, n);
+  else if ((~list->flags & LISTOPT_PTRS) && compare == fz_cmp_int
+           && size == sizeof (int_t))
+    sort_int_sort ((int_t *) items, n);
+  else if (n > SORT_INSERTION_MAX)
+    qsort (items, n, size,
+           (int (*) (const void *, const void *)) compare);
+  else
+    for (i = 1; i < n; ++i)
+      for (j = i; j > 0 && compare (items + (j - 1) * size,
+                                    items + j * size) > 0; --j)
+        list_swap (items + (j - 1) * size, items + j * size, size);
+}
+
+/* Move item INDEX in sorted vector LIST to where it belongs after it
+   has been updated.  COMPARE is called like in `fz_sort', with
+   pointers to the items.  This keeps a priority list sorted in O(n)
+   per update instead of sorting all of it again.  Returns the new
+   index of the item or a negative error code on error.  */
+int_t
+fz_sort_one (list_t *list, uint_t index, cmp_f compare)
+{
+  vector_t *self = (vector_t *) list;
+  size_t size;
+
+  if (!fz_is_vector (list) || index >= self->length)
+    return -EINVAL;
+  else if (compare == NULL)
+    compare = fz_cmp_ptr;
+
+  size = list->type_size;
+  while (index > 0
+         && compare (self->items + (index - 1) * size,
+                     self->items + index * size) > 0)
+    {
+      list_swap (self->items + (index - 1) * size,
+                 self->items + index * size, size);
+      --index;
+    }
+  while (index + 1 < self->length
+         && compare (self->items + index * size,
+                     self->items + (index + 1) * size) > 0)
+    {
+      list_swap (self->items + index * size,
+                 self->items + (index + 1) * size, size);
+      ++index;
+    }
+
+  vector_index_update (self);
+  return index;
+}
+
+/* Get the item at SLOT of LIST as `fz_at' would return it.  */
+#define list_item(list, slot) \
+  (((list)->flags & LISTOPT_PTRS) ? *((ptr_t *) (slot)) : (slot))
+
+/* Update the pointer index of LIST after its items were moved
+   without going through `fz_insert' or `fz_erase'.  */
+static inline void
+list_moved (list_t *list)
+{
+  if (fz_is_vector (list))
+    vector_index_update ((vector_t *) list);
+}
+
+/* Erase all items in LIST for which PRED returns TRUE.  PRED is called
+   once per item, in order, with the item and DATA.  The remaining
+   items are compacted in a single pass and keep their order.  Returns
+   the number of erased items or a negative error code on error.  */
+int_t
+fz_erase_if (list_t *list, pred_f pred, ptr_t data)
+{
+  size_t len;
+  uint_t r, w;
+  ptr_t slot;
+  bool_t owns;
+
+  if (list == NULL || pred == NULL)
+    return -EINVAL;
+  else if (list->at == NULL || list->erase == NULL)
+    return -ENOSYS; /* Not implemented.  */
+
+  owns = (list->flags & LISTOPT_KEEP) == LISTOPT_KEEP
+    || (list->flags & LISTOPT_PASS) == LISTOPT_PASS;
+  len = fz_len (list);
+  for (r = 0, w = 0; r < len; ++r)
+    {
+      slot = list->at (list, r);
+      if (pred (list_item (list, slot), data))
+        {
+          if (owns)
+            fz_del (*((ptr_t *) slot));
+        }
+      else if (w++ != r)
+        memcpy (list->at (list, w - 1), slot, list->type_size);
+    }
+
+  if (w < len)
+    list->erase (list, w, len - w);
+  return (int_t) (len - w);
+}
+
+/* Reorder LIST so that all items for which PRED returns TRUE come
+   after the ones for which it returns FALSE, in a single pass.  Items
+   for which PRED is FALSE keep their order.  PRED is called once per
+   item with the item and DATA.  Returns the index of the first item
+   for which PRED is TRUE, which is the length of LIST if there is
+   none, or a negative error code on error.  */
+int_t
+fz_partition (list_t *list, pred_f pred, ptr_t data)
+{
+  size_t len;
+  uint_t r, w;
+  ptr_t slot;
+
+  if (list == NULL || pred == NULL)
+    return -EINVAL;
+  else if (list->at == NULL)
+    return -ENOSYS; /* Not implemented.  */
+
+  len = fz_len (list);
+  for (r = 0, w = 0; r < len; ++r)
+    {
+      slot = list->at (list, r);
+      if (!pred (list_item (list, slot), data) && w++ != r)
+        list_swap (list->at (list, w - 1), slot, list->type_size);
+    }
+
+  if (w > 0 && w < len)
+    list_moved (list);
+  return (int_t) w;
+}
+
+/* Move NUM items starting at INDEX in SRC to the end of DST.  Unlike
+   `fz_insert' and `fz_erase' this transfers ownership of the items,
+   so nothing is retained or released.  The lists must have the same
+   item type.  Returns the index of the first moved item in DST or a
+   negative error code on error.  */
+int_t
+fz_transfer (list_t *dst, list_t *src, uint_t index, uint_t num)
+{
+  size_t dstlen;
+  uint_t i;
+  int_t err;
+
+  if (dst == NULL || src == NULL || dst == src
+      || dst->type_size != src->type_size
+      || (dst->flags & LISTOPT_PTRS) != (src->flags & LISTOPT_PTRS)
+      || index + num > fz_len (src))
+    return -EINVAL;
+  else if (dst->insert == NULL || dst->at == NULL
+           || src->erase == NULL || src->at == NULL)
+    return -ENOSYS; /* Not implemented.  */
+
+  dstlen = fz_len (dst);
+  if (num == 0)
+    return (int_t) dstlen;
+
+  err = dst->insert (dst, dstlen, num, NULL);
+  if (err < 0)
+    return err;
+
+  for (i = 0; i < num; ++i)
+    memcpy (dst->at (dst, dstlen + i), src->at (src, index + i),
+            dst->type_size);
+  list_moved (dst);
+  src->erase (src, index, num);
+  return (int_t) dstlen;
+}
+
 /* Comparator functions for search and sort.  */
 int_t
 fz_cmp_ptr (const ptr_t a, const ptr_t b)
@@ -211,25 +577,77 @@ fz_cmp_ptr (const ptr_t a, const ptr_t b)
   return -1;
 }
 
+/* Numbers are compared rather than subtracted, since the difference
+   may overflow or be truncated to zero.  */
 int_t
 fz_cmp_int (const ptr_t a, const ptr_t b)
 {
-  return *((int_t *) a) - *((int_t *) b);
+  int_t x = *((int_t *) a);
+  int_t y = *((int_t *) b);
+  return (x > y) - (x < y);
 }
 
 int_t
 fz_cmp_real (const ptr_t a, const ptr_t b)
 {
-  return *((real_t *) a) - *((real_t *) b);
+  real_t x = *((real_t *) a);
+  real_t y = *((real_t *) b);
+  return (x > y) - (x < y);
 }
 
-/* Concrete random access list class struct.  */
-typedef struct
+/* Pre-fault the item storage of LIST, and lock it into memory if LOCK
+   is TRUE.  Returns 0 on success or a negative error code on error.  */
+int_t
+fz_list_prefault (list_t *list, bool_t lock)
 {
-  list_t __parent;
-  ptr_t items;
-  size_t length;
-} vector_t;
+  if (fz_is_vector (list))
+    return fz_prefault (((vector_t *) list)->items,
+                        ((vector_t *) list)->capacity * list->type_size,
+                        lock);
+  else if (fz_instance_of (list, ringbuf_c))
+    return fz_prefault (((ringbuf_t *) list)->items,
+                        ((ringbuf_t *) list)->capacity * list->type_size,
+                        lock);
+  return -EINVAL;
+}
+
+/* Point VIEW, a vector created with LISTOPT_VIEW, at the LEN items at
+   ITEMS.  The items aren't copied or owned by VIEW, which can be
+   pointed elsewhere at any time, so one view can be used to render
+   into any number of buffers without allocating.  Returns LEN or a
+   negative error code on error.  */
+int_t
+fz_view_set (list_t *view, ptr_t items, size_t len)
+{
+  vector_t *self = (vector_t *) view;
+
+  if (!fz_is_vector (view) || (~view->flags & LISTOPT_VIEW)
+      || (items == NULL && len > 0))
+    return -EINVAL;
+
+  self->items = items;
+  self->length = len;
+  self->capacity = len;
+  vector_index_update (self);
+  return (int_t) len;
+}
+
+/* Point VIEW at LEN items of vector LIST starting at INDEX, which
+   must have the same item type.  VIEW is only valid until LIST is
+   resized.  Returns LEN or a negative error code on error.  */
+int_t
+fz_view_slice (list_t *view, const list_t *list, uint_t index, size_t len)
+{
+  const vector_t *vector = (const vector_t *) list;
+
+  if (!fz_is_vector (list) || view == NULL
+      || list->type_size != view->type_size
+      || (list->flags & LISTOPT_PTRS) != (view->flags & LISTOPT_PTRS)
+      || index + len > vector->length)
+    return -EINVAL;
+
+  return fz_view_set (view, vector->items + index * list->type_size, len);
+}
 
 /* `fz_len' implementation for `vector_c'.  */
 static size_t
@@ -247,14 +665,115 @@ vector_at (const list_t *list, uint_t index)
   return self->items + (index * list->type_size);
 }
 
+/* Allocate a block for LEN items of vector LIST, aligned to
+   MEMALIGN_SIMD if LISTOPT_ALIGN is set.  */
+static ptr_t
+vector_alloc (const list_t *list, size_t len)
+{
+  if (list->flags & LISTOPT_ALIGN)
+    return fz_malloc_aligned (len * list->type_size, MEMALIGN_SIMD);
+  return fz_malloc (len * list->type_size);
+}
+
+/* Class `vector_c' implementation of `fz_reserve'.  */
+static int_t
+vector_reserve (list_t *list, size_t capacity)
+{
+  vector_t *self = (vector_t *) list;
+  ptr_t items;
+
+  if (capacity <= self->capacity)
+    return self->capacity;
+  else if (list->flags & LISTOPT_VIEW)
+    return -ENOSPC; /* The viewed items can't be reallocated.  */
+
+  if (self->items == NULL)
+    items = vector_alloc (list, capacity);
+  else if (self->items == self->store)
+    {
+      /* Spill inline items of a small vector to the heap.  */
+      items = vector_alloc (list, capacity);
+      if (items != NULL)
+        memcpy (items, self->store, self->length * list->type_size);
+    }
+  else
+    items = fz_realloc (self->items, capacity * list->type_size);
+  if (items == NULL)
+    return -ENOMEM;
+
+  self->items = items;
+  self->capacity = capacity;
+  if ((list->flags & LISTOPT_INDEX) == LISTOPT_INDEX)
+    vector_index_resize (list);
+  return capacity;
+}
+
+/* Class `vector_c' implementation of `fz_capacity'.  */
+static size_t
+vector_capacity (const list_t *list)
+{
+  return ((const vector_t *) list)->capacity;
+}
+
+/* Class `vector_c' implementation of `fz_shrink_to_fit'.  */
+static int_t
+vector_shrink (list_t *list)
+{
+  vector_t *self = (vector_t *) list;
+  ptr_t items = NULL;
+
+  if (self->capacity == self->length || self->items == self->store
+      || (list->flags & LISTOPT_VIEW))
+    return 0;
+
+  /* Move the items of a small vector back inline if they fit.  */
+  if (self->store != NULL
+      && self->length * list->type_size <= VECTOR_INLINE_SIZE)
+    {
+      memcpy (self->store, self->items, self->length * list->type_size);
+      fz_free (self->items);
+      self->items = self->store;
+      self->capacity = VECTOR_INLINE_SIZE / list->type_size;
+      if ((list->flags & LISTOPT_INDEX) == LISTOPT_INDEX)
+        vector_index_resize (list);
+      return 0;
+    }
+
+  /* `fz_realloc' never shrinks so the items are moved to a new block.  */
+  if (self->length > 0)
+    {
+      items = vector_alloc (list, self->length);
+      if (items == NULL)
+        return -ENOMEM;
+      memcpy (items, self->items, self->length * list->type_size);
+    }
+
+  fz_free (self->items);
+  self->items = items;
+  self->capacity = self->length;
+  if ((list->flags & LISTOPT_INDEX) == LISTOPT_INDEX)
+    vector_index_resize (list);
+  return 0;
+}
+
 /* Class `vector_c' implementation of `fz_insert'.  */
 static int_t
 vector_insert (list_t *list, uint_t index, uint_t num, ptr_t item)
 {
   vector_t *self = (vector_t *) list;
   size_t length = self->length + num;
-  /* We rely on the general allocation growth policy.  */
-  self->items = fz_realloc (self->items, length * list->type_size);
+  uint_t i;
+
+  if (length > self->capacity)
+    {
+      /* A vector that is expanded once is likely to be expanded again
+         so the capacity is at least doubled.  */
+      size_t capacity = self->capacity * 2;
+      int_t err = vector_reserve (list, (capacity > length
+                                         ? capacity : length));
+      if (err < 0)
+        return err;
+    }
 
   if (index != self->length)
     {
@@ -274,6 +793,13 @@ vector_insert (list_t *list, uint_t index, uint_t num, ptr_t item)
 
   self->length = length;
 
+  /* Appending only adds to the index, anything else moves items.  */
+  if (self->nslots > 0 && index + num == length)
+    for (i = index; i < length; ++i)
+      vector_index_put (self, ((ptr_t *) self->items)[i], i);
+  else
+    vector_index_update (self);
+
   return index;
 }
 
@@ -291,6 +817,7 @@ vector_erase (list_t *list, uint_t index, uint_t num)
                (self->length - index) * list->type_size);
     }
 
+  vector_index_update (self);
   return index;
 }
 
@@ -301,8 +828,8 @@ vector_sort (list_t *list, cmp_f compare)
   vector_t *self = (vector_t *) list;
   if (self->length <= 1)
     return 0;
-  qsort (self->items, self->length, list->type_size,
-         (int (*) (const void *, const void *)) compare);
+  list_sort_items (list, self->items, self->length, compare);
+  vector_index_update (self);
   return 0;
 }
 
@@ -311,13 +838,22 @@ static ptr_t
 vector_constructor (ptr_t ptr, va_list *args)
 {
   vector_t *self = (vector_t *) list_constructor (ptr, args);
+  if (self == NULL)
+    return NULL;
   self->items = NULL;
+  self->store = NULL;
   self->length = 0;
+  self->capacity = 0;
+  self->slots = NULL;
+  self->nslots = 0;
   list_t *parent = (list_t *) self;
   parent->insert = vector_insert;
   parent->erase = vector_erase;
   parent->at = vector_at;
   parent->sort = vector_sort;
+  parent->reserve = vector_reserve;
+  parent->capacity = vector_capacity;
+  parent->shrink = vector_shrink;
   return self;
 }
 
@@ -326,8 +862,11 @@ static ptr_t
 vector_destructor (ptr_t ptr)
 {
   vector_t *self = (vector_t *) list_destructor (ptr);
-  if (self->items != NULL)
+  if (self->items != NULL && self->items != self->store
+      && (~((list_t *) self)->flags & LISTOPT_VIEW))
     fz_free (self->items);
+  if (self->slots != NULL)
+    fz_free (self->slots);
   return self;
 }
 
@@ -342,3 +881,341 @@ static const class_t _vector_c = {
 };
 
 const class_t *vector_c = &_vector_c;
+
+/* Small vector class struct.  */
+typedef struct
+{
+  vector_t __parent;
+  union
+  {
+    char bytes[VECTOR_INLINE_SIZE];
+    real_t align_real;
+    ptr_t align_ptr;
+  } store;
+} small_vector_t;
+
+/* Concrete constructor for `small_vector_c'.  Items are stored inline
+   until they outgrow VECTOR_INLINE_SIZE bytes.  Aligned vectors get
+   no inline storage since the object itself isn't aligned.  */
+static ptr_t
+small_vector_constructor (ptr_t ptr, va_list *args)
+{
+  small_vector_t *self = (small_vector_t *) vector_constructor (ptr, args);
+  vector_t *parent = (vector_t *) self;
+  list_t *list = (list_t *) self;
+  if (self == NULL)
+    return NULL;
+
+  if ((list->flags & (LISTOPT_ALIGN | LISTOPT_VIEW)) || list->type_size == 0
+      || list->type_size > VECTOR_INLINE_SIZE)
+    return self;
+
+  parent->store = self->store.bytes;
+  parent->items = parent->store;
+  parent->capacity = VECTOR_INLINE_SIZE / list->type_size;
+  if ((list->flags & LISTOPT_INDEX) == LISTOPT_INDEX)
+    vector_index_resize (list);
+  return self;
+}
+
+/* `small_vector_c' class descriptor.  */
+static const class_t _small_vector_c = {
+  sizeof (small_vector_t),
+  small_vector_constructor,
+  vector_destructor,
+  vector_length,
+  NULL,
+  NULL
+};
+
+const class_t *small_vector_c = &_small_vector_c;
+
+/* Get the address of item INDEX in ring buffer SELF.  The capacity is
+   always a power of two so wrapping is a mask instead of a modulo.  */
+#define ringbuf_item(self, index) \
+  ((self)->items + ((((self)->head + (index)) & ((self)->capacity - 1)) \
+                    * ((const list_t *) (self))->type_size))
+
+/* Number of contiguous items from INDEX in SELF before it wraps.  */
+static inline size_t
+ringbuf_span_len (const ringbuf_t *self, uint_t index)
+{
+  size_t pos = (self->head + index) & (self->capacity - 1);
+  size_t len = self->capacity - pos;
+  return len < self->length - index ? len : self->length - index;
+}
+
+/* Copy NUM items from ring buffer SELF, starting at INDEX, to DST or
+   from SRC if DST is NULL.  Items are zeroed if both are NULL.  Copies
+   are made in at most two contiguous spans.  */
+static void
+ringbuf_copy (ringbuf_t *self, uint_t index, size_t num, char *dst,
+              const char *src)
+{
+  size_t size = ((list_t *) self)->type_size;
+  size_t span;
+
+  while (num > 0)
+    {
+      span = ringbuf_span_len (self, index);
+      span = span < num ? span : num;
+      if (dst != NULL)
+        {
+          memcpy (dst, ringbuf_item (self, index), span * size);
+          dst += span * size;
+        }
+      else if (src != NULL)
+        {
+          memcpy (ringbuf_item (self, index), src, span * size);
+          src += span * size;
+        }
+      else
+        memset (ringbuf_item (self, index), 0, span * size);
+      index += span;
+      num -= span;
+    }
+}
+
+/* Move ring buffer LIST to a new block of CAPACITY items, which must
+   be zero or a power of two that fits all items.  Items are moved to
+   the beginning of the new block.  */
+static int_t
+ringbuf_relocate (list_t *list, size_t capacity)
+{
+  ringbuf_t *self = (ringbuf_t *) list;
+  ptr_t items = NULL;
+
+  if (capacity > 0)
+    {
+      items = vector_alloc (list, capacity);
+      if (items == NULL)
+        return -ENOMEM;
+      ringbuf_copy (self, 0, self->length, items, NULL);
+    }
+
+  fz_free (self->items);
+  self->items = items;
+  self->head = 0;
+  self->capacity = capacity;
+  return capacity;
+}
+
+/* `fz_len' implementation for `ringbuf_c'.  */
+static size_t
+ringbuf_length (const ptr_t list)
+{
+  return ((const ringbuf_t *) list)->length;
+}
+
+/* Class `ringbuf_c' implementation of `fz_at'.  */
+static ptr_t
+ringbuf_at (const list_t *list, uint_t index)
+{
+  const ringbuf_t *self = (const ringbuf_t *) list;
+  return ringbuf_item (self, index);
+}
+
+/* Class `ringbuf_c' implementation of `fz_reserve'.  The capacity is
+   rounded up to the next power of two.  */
+static int_t
+ringbuf_reserve (list_t *list, size_t capacity)
+{
+  ringbuf_t *self = (ringbuf_t *) list;
+  size_t pow2 = 1;
+
+  if (capacity <= self->capacity)
+    return self->capacity;
+
+  while (pow2 < capacity)
+    pow2 <<= 1;
+
+  return ringbuf_relocate (list, pow2);
+}
+
+/* Class `ringbuf_c' implementation of `fz_capacity'.  */
+static size_t
+ringbuf_capacity (const list_t *list)
+{
+  return ((const ringbuf_t *) list)->capacity;
+}
+
+/* Class `ringbuf_c' implementation of `fz_shrink_to_fit'.  The
+   capacity is kept at a power of two.  */
+static int_t
+ringbuf_shrink (list_t *list)
+{
+  ringbuf_t *self = (ringbuf_t *) list;
+  size_t pow2 = self->length > 0 ? 1 : 0;
+  int_t err;
+
+  while (pow2 < self->length)
+    pow2 <<= 1;
+
+  if (pow2 == self->capacity)
+    return 0;
+
+  err = ringbuf_relocate (list, pow2);
+  return err < 0 ? err : 0;
+}
+
+/* Class `ringbuf_c' implementation of `fz_insert'.  Inserting at the
+   front or the back doesn't move any items.  */
+static int_t
+ringbuf_insert (list_t *list, uint_t index, uint_t num, ptr_t item)
+{
+  ringbuf_t *self = (ringbuf_t *) list;
+  size_t length = self->length + num;
+  uint_t i;
+
+  if (length > self->capacity)
+    {
+      size_t capacity = self->capacity * 2;
+      int_t err = ringbuf_reserve (list, (capacity > length
+                                          ? capacity : length));
+      if (err < 0)
+        return err;
+    }
+
+  if (index == 0)
+    self->head = (self->head - num) & (self->capacity - 1);
+  else
+    for (i = self->length; i > index; --i)
+      memcpy (ringbuf_item (self, i - 1 + num),
+              ringbuf_item (self, i - 1),
+              list->type_size);
+
+  self->length = length;
+  ringbuf_copy (self, index, num, NULL, item);
+  return index;
+}
+
+/* Class `ringbuf_c' implementation of `fz_erase'.  Erasing from the
+   front or the back doesn't move any items.  */
+static int_t
+ringbuf_erase (list_t *list, uint_t index, uint_t num)
+{
+  ringbuf_t *self = (ringbuf_t *) list;
+  uint_t i;
+
+  if (index == 0)
+    self->head = (self->head + num) & (self->capacity - 1);
+  else
+    for (i = index + num; i < self->length; ++i)
+      memcpy (ringbuf_item (self, i - num),
+              ringbuf_item (self, i),
+              list->type_size);
+
+  self->length -= num;
+  return index;
+}
+
+/* Class `ringbuf_c' implementation of `fz_sort'.  */
+static int_t
+ringbuf_sort (list_t *list, cmp_f compare)
+{
+  ringbuf_t *self = (ringbuf_t *) list;
+  if (self->length <= 1)
+    return 0;
+
+  /* Wrapped items are moved into one span before sorting.  */
+  if (ringbuf_span_len (self, 0) < self->length)
+    {
+      int_t err = ringbuf_relocate (list, self->capacity);
+      if (err < 0)
+        return err;
+    }
+
+  list_sort_items (list, ringbuf_item (self, 0), self->length, compare);
+  return 0;
+}
+
+/* Copy NUM items starting at INDEX in ring buffer LIST to DST.
+   Returns the number of copied items or a negative error code.  */
+int_t
+fz_ringbuf_read (const list_t *list, uint_t index, size_t num,
+                 ptr_t dst)
+{
+  if (!fz_instance_of ((const ptr_t) list, ringbuf_c) || dst == NULL
+      || index + num > fz_len ((const ptr_t) list))
+    return -EINVAL;
+
+  ringbuf_copy ((ringbuf_t *) list, index, num, dst, NULL);
+  return (int_t) num;
+}
+
+/* Overwrite NUM items starting at INDEX in ring buffer LIST with the
+   items in SRC.  Items are not retained so this is meant for value
+   buffers.  Returns the number of copied items or a negative error
+   code.  */
+int_t
+fz_ringbuf_write (list_t *list, uint_t index, size_t num,
+                  const ptr_t src)
+{
+  if (!fz_instance_of (list, ringbuf_c) || src == NULL
+      || index + num > fz_len (list))
+    return -EINVAL;
+
+  ringbuf_copy ((ringbuf_t *) list, index, num, NULL, src);
+  return (int_t) num;
+}
+
+/* Get the address of item INDEX in ring buffer LIST and store the
+   number of items that follow contiguously, including INDEX, in NUM.
+   Loops over a span need neither masking nor bounds checks.  Returns
+   NULL if INDEX is out of bounds.  */
+ptr_t
+fz_ringbuf_span (const list_t *list, uint_t index, size_t *num)
+{
+  const ringbuf_t *self = (const ringbuf_t *) list;
+
+  if (!fz_instance_of ((const ptr_t) list, ringbuf_c) || num == NULL
+      || index >= self->length)
+    return NULL;
+
+  *num = ringbuf_span_len (self, index);
+  return ringbuf_item (self, index);
+}
+
+/* Concrete constructor for `ringbuf_c'.  */
+static ptr_t
+ringbuf_constructor (ptr_t ptr, va_list *args)
+{
+  ringbuf_t *self = (ringbuf_t *) list_constructor (ptr, args);
+  if (self == NULL)
+    return NULL;
+  self->items = NULL;
+  self->head = 0;
+  self->length = 0;
+  self->capacity = 0;
+  list_t *parent = (list_t *) self;
+  parent->insert = ringbuf_insert;
+  parent->erase = ringbuf_erase;
+  parent->at = ringbuf_at;
+  parent->sort = ringbuf_sort;
+  parent->reserve = ringbuf_reserve;
+  parent->capacity = ringbuf_capacity;
+  parent->shrink = ringbuf_shrink;
+  return self;
+}
+
+/* Concrete destructor for `ringbuf_c'.  */
+static ptr_t
+ringbuf_destructor (ptr_t ptr)
+{
+  ringbuf_t *self = (ringbuf_t *) list_destructor (ptr);
+  if (self->items != NULL)
+    fz_free (self->items);
+  return self;
+}
+
+/* `ringbuf_c' class descriptor.  */
+static const class_t _ringbuf_c = {
+  sizeof (ringbuf_t),
+  ringbuf_constructor,
+  ringbuf_destructor,
+  ringbuf_length,
+  NULL,
+  NULL
+};
+
+const class_t *ringbuf_c = &_ringbuf_c;
@@ -30,6 +30,19 @@ typedef struct list_s list_t;
 #define LISTOPT_PTRS (1 << 0)
 #define LISTOPT_KEEP ((1 << 1) | LISTOPT_PTRS)
 #define LISTOPT_PASS ((1 << 2) | LISTOPT_PTRS)
+#define LISTOPT_ALIGN (1 << 3)
+/* Keep a hash index of the pointers in a vector so that `fz_index_of'
+   with `fz_cmp_ptr' is O(1).  Appending keeps the index up to date,
+   other changes have it rebuilt on the next lookup.  */
+#define LISTOPT_INDEX ((1 << 4) | LISTOPT_PTRS)
+
+/* Vectors with this option are views of items owned by someone else,
+   see `fz_view_set'.  They can't grow beyond the viewed items.  */
+#define LISTOPT_VIEW (1 << 5)
+
+#ifndef VECTOR_INLINE_SIZE
+# define VECTOR_INLINE_SIZE 64
+#endif
 
 #define fz_new_owning_vector(type) \
   fz_new_vector (type, LISTOPT_PASS)
@@ -43,9 +56,24 @@ typedef struct list_s list_t;
 #define fz_new_simple_vector(type) \
   fz_new_vector (type, LISTOPT_NONE)
 
+#define fz_new_aligned_vector(type) \
+  fz_new_vector (type, LISTOPT_ALIGN)
+
 #define fz_new_vector(type, flags) \
   fz_new (vector_c, sizeof (type), #type, flags)
 
+#define fz_new_view(type) \
+  fz_new_vector (type, LISTOPT_VIEW)
+
+/* Small vectors store up to VECTOR_INLINE_SIZE bytes of items in the
+   list object itself and only allocate a separate block for items if
+   they outgrow it.  */
+#define fz_new_small_vector(type, flags) \
+  fz_new (small_vector_c, sizeof (type), #type, flags)
+
+#define fz_new_ringbuf(type, flags) \
+  fz_new (ringbuf_c, sizeof (type), #type, flags)
+
 #define fz_ref_at(list, index, type) \
   ((type *) fz_at (list, index))
 
@@ -66,20 +94,39 @@ typedef struct list_s list_t;
 
 #define fz_list_data(list) \
   (fz_instance_of ((const ptr_t) list, vector_c) == TRUE \
+   || fz_instance_of ((const ptr_t) list, small_vector_c) == TRUE \
    ? fz_at (list, 0) : NULL)
 
 extern ptr_t fz_at (const list_t *, uint_t);
 extern int_t fz_insert (list_t *, uint_t, uint_t, ptr_t);
 extern int_t fz_erase (list_t *, uint_t, uint_t);
 extern int_t fz_clear (list_t *, size_t);
+extern int_t fz_resize (list_t *, size_t);
+extern int_t fz_zero (list_t *);
+extern int_t fz_reserve (list_t *, size_t);
+extern size_t fz_capacity (const list_t *);
+extern int_t fz_shrink_to_fit (list_t *);
+extern int_t fz_list_prefault (list_t *, bool_t);
+extern int_t fz_view_set (list_t *, ptr_t, size_t);
+extern int_t fz_view_slice (list_t *, const list_t *, uint_t, size_t);
 extern int_t fz_index_of (const list_t *, const ptr_t, cmp_f);
 extern int_t fz_sort (list_t *, cmp_f);
+extern int_t fz_sort_one (list_t *, uint_t, cmp_f);
+extern int_t fz_erase_if (list_t *, pred_f, ptr_t);
+extern int_t fz_partition (list_t *, pred_f, ptr_t);
+extern int_t fz_transfer (list_t *, list_t *, uint_t, uint_t);
+
+extern int_t fz_ringbuf_read (const list_t *, uint_t, size_t, ptr_t);
+extern int_t fz_ringbuf_write (list_t *, uint_t, size_t, const ptr_t);
+extern ptr_t fz_ringbuf_span (const list_t *, uint_t, size_t *);
 
 extern int_t fz_cmp_ptr (const ptr_t, const ptr_t);
 extern int_t fz_cmp_int (const ptr_t, const ptr_t);
 extern int_t fz_cmp_real (const ptr_t, const ptr_t);
 
 extern const class_t *vector_c;
+extern const class_t *small_vector_c;
+extern const class_t *ringbuf_c;
 
 __END_DECLS
 
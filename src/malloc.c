@@ -18,73 +18,506 @@
    <http://www.gnu.org/licenses/>.  */
 
 #include <malloc.h>
-#include <assert.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <errno.h>
-#include <math.h>
 #include "malloc.h"
+#include "slab.h"
 
-/* Keeps track of memory usage for debugging purposes.  */
-static uint_t _total_meta = 0;
-static uint_t _total_disp = 0;
+#define MEMORY_BACKENDS_MAX 16
+#define MEMORY_BACKEND_MASK (MEMORY_BACKENDS_MAX - 1)
+#define MEMORY_FLAG_SLAB (1 << 4)
+#define MEMORY_FLAG_ALIGNED (1 << 5)
+#define MEMORY_FLAG_SHARED (1 << 6)
+#define MEMORY_ALIGN_SHIFT 8
+#define MEMORY_ALIGN_MASK (0xff << MEMORY_ALIGN_SHIFT)
+#define MEMORY_FLAGS_BLOCK (MEMORY_BACKEND_MASK | MEMORY_FLAG_SLAB \
+                            | MEMORY_FLAG_ALIGNED | MEMORY_ALIGN_MASK)
+#define MEMORY_DEFAULT_ALIGNMENT 16
+#define MEMORY_ALIGNMENT_MAX 4096
+#define MEMORY_RECLAIM_INTERVAL 10000000 /* ns */
 
-/* A `memory_meta' struct is embedded in each allocation.  */
+#define MEMORY_ACCOUNTS_MAX 64
+#define MEMORY_ACCOUNT_SHARED (&accounts[MEMORY_ACCOUNTS_MAX - 1])
+
+/* Keeps track of memory usage per thread.  An account is only ever
+   written by the thread that claimed it, except the last one which is
+   shared (atomically) by all threads that came too late to get one of
+   their own.  Counters are signed since a block may be released by
+   another thread than the one that allocated it.  */
+struct memory_account
+{
+  long long int meta;
+  long long int disp;
+  long long int peak;
+  long long int nallocs;
+  long long int nfrees;
+} __attribute__ ((aligned (64)));
+
+static struct memory_account accounts[MEMORY_ACCOUNTS_MAX];
+static uint_t naccounts = 0;
+static __thread struct memory_account *account = NULL;
+
+/* Allocation tracing hook, render scope depth of the calling thread
+   and what to do about allocations made inside a render scope.  */
+static memtrace_f memtrace = NULL;
+static ptr_t memtrace_data = NULL;
+static __thread uint_t rt_depth = 0;
+static uint_t rt_policy = RTPOLICY_IGNORE;
+
+/* Memory budget in bytes, 0 if unlimited, and the number of bytes
+   counted against it.  Usage is only counted while there's a budget
+   to keep the shared counter off the fast path.  */
+static size_t budget = 0;
+static long long int budget_used = 0;
+
+/* Blocks released in a render scope while in deferred reclaim mode,
+   linked through their first word, and the optional reclaimer.  */
+static struct memory_meta *deferred = NULL;
+static uint_t reclaim_mode = RECLAIM_NOW;
+static bool_t reclaimer_running = FALSE;
+static pthread_t reclaimer;
+static uint_t reclaimer_users = 0;
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A `memory_meta' struct is embedded in each allocation.  The lower
+   bits of FLAGS holds the index of the backend that owns the block
+   unless MEMORY_FLAG_SLAB is set.  Blocks with MEMORY_FLAG_ALIGNED
+   set start (log2 of) the alignment found in MEMORY_ALIGN_MASK bytes
+   before the returned pointer, the meta is placed just before it.
+   NUMREF is updated atomically if MEMORY_FLAG_SHARED is set.  */
 struct memory_meta
 {
   uint_t numref;
+  uint_t flags;
   size_t len;
 };
 
-/* Reference counting and memory usage tracking  version of `realloc'.
-   The meta is placed in memory before the returned pointer.  */
-ptr_t
-fz_realloc (ptr_t ptr, size_t len)
+/* Get the memory account of the calling thread, claiming one the
+   first time it is needed.  */
+static inline struct memory_account *
+memory_account ()
+{
+  if (account == NULL)
+    {
+      uint_t index = __atomic_load_n (&naccounts, __ATOMIC_RELAXED);
+      do
+        {
+          if (index >= MEMORY_ACCOUNTS_MAX - 1)
+            {
+              account = MEMORY_ACCOUNT_SHARED;
+              return account;
+            }
+        }
+      while (!__atomic_compare_exchange_n (&naccounts, &index, index + 1,
+                                           TRUE, __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED));
+      account = &accounts[index];
+    }
+  return account;
+}
+
+/* Add META and DISP bytes and NALLOCS and NFREES blocks to the account
+   of the calling thread and update its high-water mark.  */
+static void
+memory_account_add (long long int meta, long long int disp,
+                    long long int nallocs, long long int nfrees)
+{
+  struct memory_account *acc = memory_account ();
+  long long int usage;
+
+  if (acc == MEMORY_ACCOUNT_SHARED)
+    {
+      long long int peak;
+      usage = __atomic_add_fetch (&acc->meta, meta, __ATOMIC_RELAXED);
+      usage += __atomic_add_fetch (&acc->disp, disp, __ATOMIC_RELAXED);
+      __atomic_fetch_add (&acc->nallocs, nallocs, __ATOMIC_RELAXED);
+      __atomic_fetch_add (&acc->nfrees, nfrees, __ATOMIC_RELAXED);
+      peak = __atomic_load_n (&acc->peak, __ATOMIC_RELAXED);
+      while (usage > peak
+             && !__atomic_compare_exchange_n (&acc->peak, &peak, usage,
+                                              TRUE, __ATOMIC_RELAXED,
+                                              __ATOMIC_RELAXED));
+      return;
+    }
+
+  /* Private account, no read-modify-write needed.  Stores are atomic
+     only so that readers in other threads never see torn values.  */
+  __atomic_store_n (&acc->meta, acc->meta + meta, __ATOMIC_RELAXED);
+  __atomic_store_n (&acc->disp, acc->disp + disp, __ATOMIC_RELAXED);
+  __atomic_store_n (&acc->nallocs, acc->nallocs + nallocs, __ATOMIC_RELAXED);
+  __atomic_store_n (&acc->nfrees, acc->nfrees + nfrees, __ATOMIC_RELAXED);
+  usage = acc->meta + acc->disp;
+  if (usage > acc->peak)
+    __atomic_store_n (&acc->peak, usage, __ATOMIC_RELAXED);
+}
+
+/* Names of `memtrace_t' operations.  */
+static const char *memtrace_ops[] = {
+  "alloc",
+  "grow",
+  "resize",
+  "free",
+  "unref"
+};
+
+/* Apply the render scope policy to operation OP of LEN bytes made
+   from CALLER, which is about to hit the allocator backend.  */
+static void
+memory_rt_check (uint_t op, size_t len, ptr_t caller)
+{
+  uint_t policy;
+  if (rt_depth == 0)
+    return;
+
+  policy = __atomic_load_n (&rt_policy, __ATOMIC_RELAXED);
+  if (policy == RTPOLICY_IGNORE)
+    return;
+
+  fprintf (stderr, "libfreeztile: %s of %lu bytes in render scope from %p\n",
+           memtrace_ops[op], (unsigned long) len, caller);
+  if (policy == RTPOLICY_ABORT)
+    abort ();
+}
+
+/* Report operation OP on PTR of LEN bytes made from CALLER to the
+   tracing hook, if any.  */
+static inline void
+memory_trace (uint_t op, ptr_t ptr, size_t len, ptr_t caller)
+{
+  memtrace_f trace = __atomic_load_n (&memtrace, __ATOMIC_ACQUIRE);
+  if (trace != NULL)
+    {
+      memtrace_t record = {op, ptr, len, caller, rt_depth > 0};
+      trace (&record, memtrace_data);
+    }
+}
+
+/* `malloc_allocator' alloc callback.  */
+static ptr_t
+libc_alloc (size_t len, size_t align)
+{
+  ptr_t ptr = NULL;
+  if (align <= MEMORY_DEFAULT_ALIGNMENT)
+    return malloc (len);
+  if (posix_memalign (&ptr, align, len) != 0)
+    return NULL;
+  return ptr;
+}
+
+/* `malloc_allocator' realloc callback.  */
+static ptr_t
+libc_realloc (ptr_t ptr, size_t oldlen, size_t len)
+{
+  (void) oldlen;
+  return realloc (ptr, len);
+}
+
+/* `malloc_allocator' free callback.  */
+static void
+libc_free (ptr_t ptr, size_t len)
+{
+  (void) len;
+  free (ptr);
+}
+
+/* Default allocator backend using the C library.  */
+static const allocator_t _malloc_allocator = {
+  libc_alloc,
+  libc_realloc,
+  libc_free
+};
+
+const allocator_t *malloc_allocator = &_malloc_allocator;
+
+/* Registered backends.  Blocks remember the index of their backend so
+   they can be released properly after the current backend changes.  */
+static const allocator_t *backends[MEMORY_BACKENDS_MAX] = {
+  &_malloc_allocator
+};
+static uint_t current_backend = 0;
+
+/* Get the alignment of the block of META if MEMORY_FLAG_ALIGNED is
+   set.  */
+#define memory_alignment(meta) \
+  ((size_t) 1 << (((meta)->flags & MEMORY_ALIGN_MASK) >> MEMORY_ALIGN_SHIFT))
+
+/* Get the number of bytes that fits in the block of META.  */
+static inline size_t
+memory_capacity (const struct memory_meta *meta)
+{
+  if (meta->flags & MEMORY_FLAG_SLAB)
+    return fz_slab_capacity ((const ptr_t) meta)
+      - sizeof (struct memory_meta);
+  return meta->len;
+}
+
+/* Allocate a block of LEN bytes plus meta with the returned pointer
+   aligned to ALIGN bytes.  Small blocks are taken from the slab
+   allocator, larger or over-aligned ones from the current backend.  */
+static struct memory_meta *
+memory_alloc (size_t len, size_t align, uint_t *flags)
+{
+  uint_t backend, shift;
+  char *block;
+
+  if (align <= MEMORY_DEFAULT_ALIGNMENT)
+    {
+      block = fz_slab_alloc (sizeof (struct memory_meta) + len);
+      if (block != NULL)
+        {
+          *flags = MEMORY_FLAG_SLAB;
+          return (struct memory_meta *) block;
+        }
+    }
+
+  backend = __atomic_load_n (&current_backend, __ATOMIC_ACQUIRE);
+  *flags = backend;
+  if (align <= MEMORY_DEFAULT_ALIGNMENT)
+    return ((struct memory_meta *)
+            backends[backend]->alloc (sizeof (struct memory_meta) + len,
+                                      MEMORY_DEFAULT_ALIGNMENT));
+
+  /* Reserve a whole ALIGN sized prefix to keep the meta in.  */
+  block = backends[backend]->alloc (align + len, align);
+  if (block == NULL)
+    return NULL;
+
+  for (shift = 0; ((size_t) 1 << shift) < align; ++shift);
+  *flags |= MEMORY_FLAG_ALIGNED | (shift << MEMORY_ALIGN_SHIFT);
+  return ((struct memory_meta *) (block + align)) - 1;
+}
+
+/* Release the block of META to the allocator that created it.  */
+static void
+memory_release (struct memory_meta *meta)
+{
+  const allocator_t *owner = backends[meta->flags & MEMORY_BACKEND_MASK];
+  if (meta->flags & MEMORY_FLAG_SLAB)
+    fz_slab_free (meta);
+  else if (meta->flags & MEMORY_FLAG_ALIGNED)
+    owner->free ((char *) (meta + 1) - memory_alignment (meta),
+                 memory_alignment (meta) + meta->len);
+  else
+    owner->free (meta, sizeof (struct memory_meta) + meta->len);
+}
+
+/* Check if the release of META should be left to `fz_collect'.  Slab
+   blocks are cheap to release in place and blocks too small to hold
+   the link are rare enough to be released right away.  */
+static inline bool_t
+memory_deferrable (const struct memory_meta *meta)
+{
+  return (rt_depth > 0
+          && __atomic_load_n (&reclaim_mode, __ATOMIC_RELAXED) != RECLAIM_NOW
+          && ~meta->flags & MEMORY_FLAG_SLAB
+          && memory_capacity (meta) >= sizeof (struct memory_meta *))
+    ? TRUE : FALSE;
+}
+
+/* Push META onto the deferred list.  */
+static void
+memory_defer (struct memory_meta *meta)
+{
+  struct memory_meta **link = (struct memory_meta **) (meta + 1);
+  *link = __atomic_load_n (&deferred, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n (&deferred, link, meta, TRUE,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Release META now or later, see `fz_set_reclaim'.  */
+static inline void
+memory_dispose (struct memory_meta *meta)
+{
+  if (memory_deferrable (meta))
+    memory_defer (meta);
+  else
+    memory_release (meta);
+}
+
+/* Grow the block of META to fit LEN bytes.  The block is resized in
+   place by its backend if possible, otherwise it's moved.  Aligned
+   blocks are always moved since `realloc' may break the alignment.  */
+static struct memory_meta *
+memory_grow (struct memory_meta *meta, size_t len)
+{
+  struct memory_meta *grown;
+  uint_t backend = __atomic_load_n (&current_backend, __ATOMIC_ACQUIRE);
+  const allocator_t *owner = backends[meta->flags & MEMORY_BACKEND_MASK];
+  size_t align = MEMORY_DEFAULT_ALIGNMENT;
+  uint_t flags;
+
+  if (meta->flags & MEMORY_FLAG_ALIGNED)
+    align = memory_alignment (meta);
+  else if (~meta->flags & MEMORY_FLAG_SLAB
+           && (meta->flags & MEMORY_BACKEND_MASK) == backend
+           && owner->realloc != NULL)
+    return ((struct memory_meta *)
+            owner->realloc (meta,
+                            sizeof (struct memory_meta) + meta->len,
+                            sizeof (struct memory_meta) + len));
+
+  grown = memory_alloc (len, align, &flags);
+  if (grown == NULL)
+    return NULL;
+
+  memcpy (grown, meta, sizeof (struct memory_meta) + meta->len);
+  memory_dispose (meta);
+  grown->flags = (grown->flags & ~MEMORY_FLAGS_BLOCK) | flags;
+  return grown;
+}
+
+/* Count LEN more bytes against the memory budget.  Returns FALSE and
+   sets `errno' to ENOMEM if that would exceed the budget.  */
+static inline bool_t
+memory_budget_take (size_t len)
+{
+  if (__atomic_load_n (&budget, __ATOMIC_RELAXED) == 0)
+    return TRUE;
+
+  if (__atomic_add_fetch (&budget_used, (long long int) len,
+                          __ATOMIC_RELAXED)
+      > (long long int) __atomic_load_n (&budget, __ATOMIC_RELAXED))
+    {
+      __atomic_sub_fetch (&budget_used, (long long int) len,
+                          __ATOMIC_RELAXED);
+      errno = ENOMEM;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Count LEN bytes less against the memory budget.  */
+static inline void
+memory_budget_give (size_t len)
+{
+  if (__atomic_load_n (&budget, __ATOMIC_RELAXED) != 0)
+    __atomic_sub_fetch (&budget_used, (long long int) len,
+                        __ATOMIC_RELAXED);
+}
+
+/* Implementation of `fz_realloc' on behalf of CALLER.  New blocks
+   are aligned to ALIGN bytes.  Returns NULL and sets `errno' to ENOMEM
+   on failure.  */
+static ptr_t
+memory_realloc (ptr_t ptr, size_t len, size_t align, ptr_t caller)
 {
   struct memory_meta *meta;
+  uint_t flags;
+  uint_t op = MEMTRACE_RESIZE;
 
   if (ptr != NULL)
     {
       /* If a pointer is given we expect to find an embedded meta struct.  */
       meta = ((struct memory_meta *) ptr) - 1;
       if (meta->len >= len)
-        /* Current size is sufficent.  */
-        return ptr;
-      else
         {
-          /* Not sufficent, decrease global counter.  */
-          _total_disp -= meta->len;
-          /* Memory that is expanded once is likely to be expanded again
-             (for instance in a list that is growing) so we allocate some
-             extra space right away, hopefully reducing the number of calls
-             to `realloc'.  We increase LEN to the nearest power of 2.  */
-          len = (size_t) pow (2, ceil (log (len) / log (2)));
+          /* Current size is sufficent.  */
+          memory_trace (op, ptr, len, caller);
+          return ptr;
         }
-    }
-  else
-    meta = NULL;
 
-  /* Allocate new space and increase global counter.  */
-  meta = ((struct memory_meta *)
-          realloc (meta, sizeof (struct memory_meta) + len));
-  assert (meta);
-  _total_disp += (meta->len = len);
+      /* Growth within the capacity of the block counts as well, since
+         the whole length is given back when it's freed.  */
+      if (memory_budget_take (len - meta->len) == FALSE)
+        return NULL;
 
-  if (ptr == NULL)
+      if (memory_capacity (meta) < len)
+        {
+          /* Blocks are grown to exactly LEN bytes, growth policies
+             are up to the caller (see `fz_reserve').  */
+          struct memory_meta *grown;
+          op = MEMTRACE_GROW;
+          memory_rt_check (op, len, caller);
+          grown = memory_grow (meta, len);
+          if (grown == NULL)
+            {
+              /* Like `realloc', leave PTR untouched.  */
+              memory_budget_give (len - meta->len);
+              errno = ENOMEM;
+              return NULL;
+            }
+          meta = grown;
+        }
+
+      /* Increase usage counter.  */
+      memory_account_add (0, (long long int) (len - meta->len), 0, 0);
+      meta->len = len;
+    }
+  else
     {
-      /* Reset memory and increase meta counter if PTR is new.  */
-      _total_meta += sizeof (struct memory_meta);
+      /* Allocate new space.  */
+      op = MEMTRACE_ALLOC;
+      memory_rt_check (op, len, caller);
+      if (memory_budget_take (sizeof (struct memory_meta) + len) == FALSE)
+        return NULL;
+      meta = memory_alloc (len, align, &flags);
+      if (meta == NULL)
+        {
+          memory_budget_give (sizeof (struct memory_meta) + len);
+          errno = ENOMEM;
+          return NULL;
+        }
+#ifdef ENABLE_ATOMIC_REFCOUNT
+      flags |= MEMORY_FLAG_SHARED;
+#endif
+      meta->flags = flags;
+
+      /* Reset memory and increase usage counters.  */
+      meta->len = len;
       meta->numref = 1;
       memset (meta + 1, 0, len);
+      memory_account_add (sizeof (struct memory_meta), len, 1, 0);
     }
 
+  memory_trace (op, meta + 1, len, caller);
   return meta + 1;
 }
 
+/* Reference counting and memory usage tracking  version of `realloc'.
+   The meta is placed in memory before the returned pointer.  */
+ptr_t
+fz_realloc (ptr_t ptr, size_t len)
+{
+  return memory_realloc (ptr, len, MEMORY_DEFAULT_ALIGNMENT,
+                         __builtin_return_address (0));
+}
+
 /* Refenece counting version of `malloc'. See `fz_realloc'.  */
 ptr_t
 fz_malloc (size_t len)
 {
-  return fz_realloc (NULL, len);
+  return memory_realloc (NULL, len, MEMORY_DEFAULT_ALIGNMENT,
+                         __builtin_return_address (0));
+}
+
+/* Like `fz_malloc' but the returned pointer is aligned to ALIGN bytes,
+   which must be a power of 2 no larger than a page.  The alignment is
+   kept when the block is grown by `fz_realloc'.  Returns NULL on
+   error.  */
+ptr_t
+fz_malloc_aligned (size_t len, size_t align)
+{
+  if (align == 0 || (align & (align - 1)) != 0
+      || align > MEMORY_ALIGNMENT_MAX)
+    return NULL;
+  if (align < MEMORY_DEFAULT_ALIGNMENT)
+    align = MEMORY_DEFAULT_ALIGNMENT;
+  return memory_realloc (NULL, len, align, __builtin_return_address (0));
+}
+
+/* Add DELTA to the reference counter of META and return the result.
+   Blocks that are not shared between threads take the plain path.  */
+static inline uint_t
+memory_ref_add (struct memory_meta *meta, int_t delta)
+{
+  if (meta->flags & MEMORY_FLAG_SHARED)
+    return __atomic_add_fetch (&meta->numref, delta, __ATOMIC_ACQ_REL);
+  return meta->numref += delta;
 }
 
 /* Increase the reference counter of pointer PTR.  */
@@ -92,7 +525,7 @@ ptr_t
 fz_retain (ptr_t ptr)
 {
   if (ptr != NULL)
-    ++(((struct memory_meta *) ptr) - 1)->numref;
+    memory_ref_add (((struct memory_meta *) ptr) - 1, 1);
   return ptr;
 }
 
@@ -103,7 +536,46 @@ fz_refcount (ptr_t ptr)
 {
   if (ptr == NULL)
     return -EINVAL;
-  return (((struct memory_meta *) ptr) - 1)->numref;
+  return __atomic_load_n (&(((struct memory_meta *) ptr) - 1)->numref,
+                          __ATOMIC_ACQUIRE);
+}
+
+/* Implementation of `fz_release' on behalf of CALLER.  */
+static int_t
+memory_unref (ptr_t ptr, ptr_t (*finalize) (ptr_t), ptr_t caller)
+{
+  struct memory_meta *meta;
+  uint_t numref;
+
+  if (ptr == NULL)
+    return -EINVAL;
+
+  meta = ((struct memory_meta *) ptr) - 1;
+  numref = memory_ref_add (meta, -1);
+  if (numref == 0)
+    {
+      /* Finalize, decrease memory usage counters and free memory if
+         reference counter reaches zero.  */
+      bool_t defer = memory_deferrable (meta);
+      if (finalize != NULL)
+        finalize (ptr);
+      if (defer == FALSE)
+        memory_rt_check (MEMTRACE_FREE, meta->len, caller);
+      memory_account_add (-(long long int) sizeof (struct memory_meta),
+                          -(long long int) meta->len, 0, 1);
+      memory_budget_give (sizeof (struct memory_meta) + meta->len);
+      memory_trace (MEMTRACE_FREE, ptr, meta->len, caller);
+      if (defer == TRUE)
+        memory_defer (meta);
+      else
+        memory_release (meta);
+      return 0;
+    }
+
+  /* Another thread may free a shared block at any time from here on,
+     so only the pointer value is passed to the hook.  */
+  memory_trace (MEMTRACE_UNREF, ptr, 0, caller);
+  return numref;
 }
 
 /* Free the memory pointed to by PTR if decreasing it's reference
@@ -112,32 +584,381 @@ fz_refcount (ptr_t ptr)
 int_t
 fz_free (ptr_t ptr)
 {
+  return memory_unref (ptr, NULL, __builtin_return_address (0));
+}
+
+/* Like `fz_free' but FINALIZE is called with PTR right before it is
+   freed.  The decrease and the decision to finalize is a single atomic
+   step for shared blocks, see `fz_set_shared'.  */
+int_t
+fz_release (ptr_t ptr, ptr_t (*finalize) (ptr_t))
+{
+  return memory_unref (ptr, finalize, __builtin_return_address (0));
+}
+
+/* Like `fz_free' but the last reference is handed back to the caller
+   instead of freeing PTR: its counter is left at one and 0 returned,
+   after which the caller may reuse PTR or free it.  The decrease is a
+   single atomic step for shared blocks, like in `fz_release'.  */
+int_t
+fz_unref (ptr_t ptr)
+{
+  struct memory_meta *meta;
+  uint_t numref;
+
   if (ptr == NULL)
     return -EINVAL;
 
-  struct memory_meta *meta = ((struct memory_meta *) ptr) - 1;
+  meta = ((struct memory_meta *) ptr) - 1;
+  numref = memory_ref_add (meta, -1);
+  if (numref == 0)
+    /* No one else can see the block anymore.  */
+    __atomic_store_n (&meta->numref, 1, __ATOMIC_RELAXED);
+  else
+    memory_trace (MEMTRACE_UNREF, ptr, 0, __builtin_return_address (0));
+  return numref;
+}
+
+/* Make the reference counter of PTR atomic if SHARED is TRUE so that
+   the block may be retained and freed from several threads at once,
+   or use the cheaper non-atomic path if it's FALSE.  Only call this
+   while PTR is still owned by a single thread.  Blocks are shared by
+   default if configured with --enable-atomic-refcount.  Returns 0 on
+   success or a negative error code on error.  */
+int_t
+fz_set_shared (ptr_t ptr, bool_t shared)
+{
+  struct memory_meta *meta;
+  if (ptr == NULL)
+    return -EINVAL;
 
-  if (--(meta->numref) == 0)
-    {
-      /* Decrease memory usage counters and free memory if
-         reference counter reaches zero.  */
-      _total_meta -= sizeof (struct memory_meta);
-      _total_disp -= meta->len;
-      free (meta);
-      return 0;
-    }
+  meta = ((struct memory_meta *) ptr) - 1;
+  if (shared == TRUE)
+    meta->flags |= MEMORY_FLAG_SHARED;
+  else
+    meta->flags &= ~MEMORY_FLAG_SHARED;
+  return 0;
+}
 
-  return meta->numref;
+/* Check if the reference counter of PTR is atomic.  */
+bool_t
+fz_is_shared (ptr_t ptr)
+{
+  if (ptr == NULL)
+    return FALSE;
+  return ((((struct memory_meta *) ptr) - 1)->flags & MEMORY_FLAG_SHARED)
+    ? TRUE : FALSE;
+}
+
+/* Limit the fz_* function family memory usage (as in
+   `fz_memusage (0)') to BYTES, or remove the limit if BYTES is 0.
+   Allocations that would exceed the budget fail with ENOMEM.  The
+   budget is process wide.  Returns 0 on success or a negative error
+   code on error.  */
+int_t
+fz_set_membudget (size_t bytes)
+{
+  /* Start counting from the current usage.  */
+  if (bytes != 0)
+    __atomic_store_n (&budget_used, (long long int) fz_memusage (0),
+                      __ATOMIC_RELAXED);
+  __atomic_store_n (&budget, bytes, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/* Get the current memory budget, 0 if unlimited.  */
+size_t
+fz_membudget ()
+{
+  return __atomic_load_n (&budget, __ATOMIC_RELAXED);
 }
 
 /* Check the current fz_* function family memory usage.  */
 size_t
 fz_memusage (uint_t flags)
 {
+  memstats_t stats;
   size_t size = 0;
+  fz_memstats (&stats, 0);
   if ((flags & MEMUSAGE_META) || flags == 0)
-    size += _total_meta;
+    size += stats.meta;
   if ((flags & MEMUSAGE_DISP) || flags == 0)
-    size += _total_disp;
+    size += stats.disp;
   return size;
 }
+
+/* Fill in STATS with the memory statistics of all threads merged, or
+   of the calling thread only if MEMSTATS_THREAD is set in FLAGS.  The
+   merged peak is the sum of the per thread peaks and thus an upper
+   bound of the actual high-water mark.  Returns 0 on success or a
+   negative error code on error.  */
+int_t
+fz_memstats (memstats_t *stats, uint_t flags)
+{
+  long long int meta = 0, disp = 0, peak = 0, nallocs = 0, nfrees = 0;
+  uint_t i, n = MEMORY_ACCOUNTS_MAX;
+  struct memory_account *acc = accounts;
+
+  if (stats == NULL)
+    return -EINVAL;
+
+  if (flags & MEMSTATS_THREAD)
+    {
+      acc = memory_account ();
+      n = 1;
+    }
+
+  for (i = 0; i < n; ++i, ++acc)
+    {
+      meta += __atomic_load_n (&acc->meta, __ATOMIC_RELAXED);
+      disp += __atomic_load_n (&acc->disp, __ATOMIC_RELAXED);
+      peak += __atomic_load_n (&acc->peak, __ATOMIC_RELAXED);
+      nallocs += __atomic_load_n (&acc->nallocs, __ATOMIC_RELAXED);
+      nfrees += __atomic_load_n (&acc->nfrees, __ATOMIC_RELAXED);
+    }
+
+  /* A thread that only releases blocks allocated elsewhere has a
+     negative balance, hence the clamping.  */
+  stats->meta = meta > 0 ? meta : 0;
+  stats->disp = disp > 0 ? disp : 0;
+  stats->peak = peak > 0 ? peak : 0;
+  stats->nallocs = nallocs;
+  stats->nfrees = nfrees;
+  return 0;
+}
+
+/* Reset the high-water mark of the calling thread to its current
+   memory usage.  */
+void
+fz_memstats_reset_peak ()
+{
+  struct memory_account *acc = memory_account ();
+  long long int usage = (__atomic_load_n (&acc->meta, __ATOMIC_RELAXED)
+                         + __atomic_load_n (&acc->disp, __ATOMIC_RELAXED));
+  __atomic_store_n (&acc->peak, usage, __ATOMIC_RELAXED);
+}
+
+/* Make ALLOCATOR the backend of subsequent allocations.  Blocks that
+   are already allocated are released to the backend that created
+   them.  Returns zero on success or a negative error code.  */
+int_t
+fz_set_allocator (const allocator_t *allocator)
+{
+  uint_t i;
+  const allocator_t *expected;
+
+  if (allocator == NULL || allocator->alloc == NULL
+      || allocator->free == NULL)
+    return -EINVAL;
+
+  for (i = 0; i < MEMORY_BACKENDS_MAX; ++i)
+    {
+      expected = NULL;
+      if (__atomic_load_n (&backends[i], __ATOMIC_ACQUIRE) == allocator
+          || __atomic_compare_exchange_n (&backends[i], &expected,
+                                          allocator, FALSE,
+                                          __ATOMIC_ACQ_REL,
+                                          __ATOMIC_ACQUIRE)
+          || expected == allocator)
+        {
+          __atomic_store_n (&current_backend, i, __ATOMIC_RELEASE);
+          return 0;
+        }
+    }
+
+  return -ENOMEM;
+}
+
+/* Get the backend used for new allocations.  */
+const allocator_t *
+fz_get_allocator ()
+{
+  return backends[__atomic_load_n (&current_backend, __ATOMIC_ACQUIRE)];
+}
+
+/* Install TRACE to be called with DATA after every fz_* allocation
+   function call, or remove the hook if TRACE is NULL.  The hook may be
+   called concurrently from several threads.  */
+void
+fz_set_memtrace (memtrace_f trace, ptr_t data)
+{
+  __atomic_store_n (&memtrace_data, data, __ATOMIC_RELAXED);
+  __atomic_store_n (&memtrace, trace, __ATOMIC_RELEASE);
+}
+
+/* Set what happens when memory is allocated, grown or released by the
+   allocator backend inside a render scope.  Returns 0 on success or a
+   negative error code on error.  */
+int_t
+fz_set_rtpolicy (uint_t policy)
+{
+  if (policy > RTPOLICY_ABORT)
+    return -EINVAL;
+  __atomic_store_n (&rt_policy, policy, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/* Enter a render scope on the calling thread.  Scopes nest.  */
+void
+fz_rt_enter ()
+{
+  ++rt_depth;
+}
+
+/* Leave the innermost render scope of the calling thread.  */
+void
+fz_rt_leave ()
+{
+  if (rt_depth > 0)
+    --rt_depth;
+}
+
+/* Check if the calling thread is inside a render scope.  */
+bool_t
+fz_rt_active ()
+{
+  return rt_depth > 0;
+}
+
+/* Release all blocks whose release has been deferred.  Must not be
+   called in a render scope.  Returns the number of released blocks.  */
+size_t
+fz_collect ()
+{
+  struct memory_meta *meta = __atomic_exchange_n (&deferred, NULL,
+                                                  __ATOMIC_ACQUIRE);
+  size_t count = 0;
+  while (meta != NULL)
+    {
+      struct memory_meta *next = *(struct memory_meta **) (meta + 1);
+      memory_release (meta);
+      meta = next;
+      ++count;
+    }
+  return count;
+}
+
+/* Background reclaimer thread routine.  */
+static void *
+memory_reclaimer (void *arg)
+{
+  struct timespec interval = {0, MEMORY_RECLAIM_INTERVAL};
+  (void) arg;
+  while (__atomic_load_n (&reclaimer_running, __ATOMIC_ACQUIRE) == TRUE)
+    {
+      fz_collect ();
+      nanosleep (&interval, NULL);
+    }
+  return NULL;
+}
+
+/* Implementation of `fz_set_reclaim'.  Called with `reclaim_lock'
+   held.  */
+static int_t
+memory_set_reclaim (uint_t mode)
+{
+  int err;
+
+  if (mode == RECLAIM_THREAD && reclaimer_running == FALSE)
+    {
+      __atomic_store_n (&reclaimer_running, TRUE, __ATOMIC_RELEASE);
+      err = pthread_create (&reclaimer, NULL, memory_reclaimer, NULL);
+      if (err != 0)
+        {
+          __atomic_store_n (&reclaimer_running, FALSE, __ATOMIC_RELEASE);
+          return -err;
+        }
+    }
+  else if (mode != RECLAIM_THREAD && reclaimer_running == TRUE)
+    {
+      __atomic_store_n (&reclaimer_running, FALSE, __ATOMIC_RELEASE);
+      pthread_join (reclaimer, NULL);
+    }
+
+  __atomic_store_n (&reclaim_mode, mode, __ATOMIC_RELAXED);
+  if (mode == RECLAIM_NOW)
+    fz_collect ();
+  return 0;
+}
+
+/* Set how blocks released in a render scope are reclaimed.  With
+   RECLAIM_NOW (the default) they're handed back to their allocator
+   right away.  With RECLAIM_DEFER they're queued until `fz_collect' is
+   called and RECLAIM_THREAD starts a background thread that collects
+   them periodically.  Slab blocks are always released right away.
+   The mode is process wide, so with several independent users see
+   `fz_reclaim_start' instead.  Returns 0 on success or a negative
+   error code on error.  */
+int_t
+fz_set_reclaim (uint_t mode)
+{
+  int_t err;
+  if (mode > RECLAIM_THREAD)
+    return -EINVAL;
+
+  pthread_mutex_lock (&reclaim_lock);
+  err = memory_set_reclaim (mode);
+  pthread_mutex_unlock (&reclaim_lock);
+  return err;
+}
+
+/* Have blocks released in a render scope reclaimed by the background
+   thread, as with RECLAIM_THREAD, until every call to this function
+   has been balanced by a call to `fz_reclaim_stop'.  Returns 0 on
+   success or a negative error code on error.  */
+int_t
+fz_reclaim_start ()
+{
+  int_t err = 0;
+
+  pthread_mutex_lock (&reclaim_lock);
+  if (reclaimer_users == 0)
+    err = memory_set_reclaim (RECLAIM_THREAD);
+  if (err == 0)
+    ++reclaimer_users;
+  pthread_mutex_unlock (&reclaim_lock);
+  return err;
+}
+
+/* Balance a call to `fz_reclaim_start'.  The last one stops the
+   background thread and releases what's left in its queue, see
+   RECLAIM_NOW.  Returns 0 on success or a negative error code on
+   error.  */
+int_t
+fz_reclaim_stop ()
+{
+  int_t err = 0;
+
+  pthread_mutex_lock (&reclaim_lock);
+  if (reclaimer_users == 0)
+    err = -EINVAL;
+  else if (--reclaimer_users == 0)
+    err = memory_set_reclaim (RECLAIM_NOW);
+  pthread_mutex_unlock (&reclaim_lock);
+  return err;
+}
+
+/* Touch every page in the LEN bytes at ADDR so that later accesses
+   don't page fault, and lock them into memory if LOCK is TRUE.  The
+   contents are left as they are.  Returns 0 on success or a negative
+   error code on error.  */
+int_t
+fz_prefault (ptr_t addr, size_t len, bool_t lock)
+{
+  volatile char *bytes = (volatile char *) addr;
+  size_t page = (size_t) sysconf (_SC_PAGESIZE);
+  size_t offset;
+
+  if (addr == NULL)
+    return len == 0 ? 0 : -EINVAL;
+
+  for (offset = 0; offset < len; offset += page)
+    bytes[offset] = bytes[offset];
+  if (len > 0)
+    bytes[len - 1] = bytes[len - 1];
+
+  if (lock == TRUE && len > 0 && mlock (addr, len) != 0)
+    return -errno;
+
+  return 0;
+}
@@ -26,14 +26,95 @@
 #define MEMUSAGE_DISP (1 << 1)
 #define MEMUSAGE_All (MEMUSAGE_META | MEMUSAGE_DISP)
 
+#define MEMSTATS_THREAD (1 << 0)
+
+/* Alignment suitable for sample buffers processed with SIMD
+   instructions, which is also the size of a cache line.  */
+#define MEMALIGN_SIMD 64
+
+#define MEMTRACE_ALLOC 0
+#define MEMTRACE_GROW 1
+#define MEMTRACE_RESIZE 2
+#define MEMTRACE_FREE 3
+#define MEMTRACE_UNREF 4
+
+#define RTPOLICY_IGNORE 0
+#define RTPOLICY_WARN 1
+#define RTPOLICY_ABORT 2
+
+#define RECLAIM_NOW 0
+#define RECLAIM_DEFER 1
+#define RECLAIM_THREAD 2
+
 __BEGIN_DECLS
 
+/* Allocator backend descriptor.  `alloc' gets the requested length
+   and alignment, `realloc' and `free' get the current length of the
+   block as well.  `realloc' may be NULL.  */
+typedef struct
+{
+  ptr_t (*alloc) (size_t, size_t);
+  ptr_t (*realloc) (ptr_t, size_t, size_t);
+  void (*free) (ptr_t, size_t);
+} allocator_t;
+
+/* Memory statistics as reported by `fz_memstats'.  META and DISP are
+   the current usage as in `fz_memusage', PEAK is the high-water mark
+   of their sum and NALLOCS and NFREES count blocks allocated and
+   finally released.  */
+typedef struct
+{
+  size_t meta;
+  size_t disp;
+  size_t peak;
+  size_t nallocs;
+  size_t nfrees;
+} memstats_t;
+
+/* Allocation trace record.  OP is one of the MEMTRACE_* operations,
+   PTR is the (resulting) block of LEN bytes (LEN is 0 for
+   MEMTRACE_UNREF), CALLER the return address of the fz_* call and RT
+   tells if the call was made in a render scope.  */
+typedef struct
+{
+  uint_t op;
+  ptr_t ptr;
+  size_t len;
+  ptr_t caller;
+  bool_t rt;
+} memtrace_t;
+
+typedef void (*memtrace_f) (const memtrace_t *, ptr_t);
+
 extern ptr_t fz_realloc (ptr_t, size_t);
 extern ptr_t fz_malloc (size_t);
+extern ptr_t fz_malloc_aligned (size_t, size_t);
 extern ptr_t fz_retain (ptr_t);
 extern int_t fz_refcount (ptr_t);
 extern int_t fz_free (ptr_t);
+extern int_t fz_release (ptr_t, ptr_t (*) (ptr_t));
+extern int_t fz_unref (ptr_t);
+extern int_t fz_set_shared (ptr_t, bool_t);
+extern bool_t fz_is_shared (ptr_t);
 extern size_t fz_memusage (uint_t flags);
+extern int_t fz_set_membudget (size_t);
+extern size_t fz_membudget ();
+extern int_t fz_memstats (memstats_t *, uint_t flags);
+extern void fz_memstats_reset_peak ();
+extern int_t fz_set_allocator (const allocator_t *);
+extern const allocator_t * fz_get_allocator ();
+extern void fz_set_memtrace (memtrace_f, ptr_t);
+extern int_t fz_set_rtpolicy (uint_t);
+extern void fz_rt_enter ();
+extern void fz_rt_leave ();
+extern bool_t fz_rt_active ();
+extern int_t fz_set_reclaim (uint_t);
+extern int_t fz_reclaim_start ();
+extern int_t fz_reclaim_stop ();
+extern size_t fz_collect ();
+extern int_t fz_prefault (ptr_t, size_t, bool_t);
+
+extern const allocator_t *malloc_allocator;
 
 __END_DECLS
 
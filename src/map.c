@@ -17,28 +17,73 @@
    along with libfreeztile; see the file COPYING.  If not see
    <http://www.gnu.org/licenses/>.  */
 
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include "map.h"
 #include "malloc.h"
 
-#ifndef MAP_INDEX_SIZE
-#define MAP_INDEX_SIZE 53
+/* The index is an open addressing hash table with a power of two
+   capacity of at least MAP_MIN_CAPACITY slots that grows when more
+   than 3/4 of its slots are used.  */
+#ifndef MAP_MIN_CAPACITY
+# define MAP_MIN_CAPACITY 8
 #endif
 
-/* Internal map item struct.  */
+/* Values of at most MAP_SMALL_SIZE bytes are stored in slabs of
+   MAP_SLAB_ITEMS items, so that setting and unsetting small values
+   such as voice states rarely allocates.  */
+#ifndef MAP_SMALL_SIZE
+# define MAP_SMALL_SIZE 64
+#endif
+#ifndef MAP_SLAB_ITEMS
+# define MAP_SLAB_ITEMS 8
+#endif
+
+/* Internal map item struct, followed by the value.  SIZE is the space
+   available for the value, MAP_SMALL_SIZE for slab items, and POS is
+   the position of the item in insertion order.  */
 typedef struct item_s item_t;
 struct item_s {
   uintptr_t key;
-  item_t *next;
   size_t size;
+  size_t pos;
 };
 
+#define MAP_SMALL_BLOCK (sizeof (item_t) + MAP_SMALL_SIZE)
+
+/* Block of MAP_SLAB_ITEMS small items.  */
+typedef struct slab_s slab_t;
+struct slab_s {
+  slab_t *next;
+  size_t pad; /* Keeps items aligned like blocks from `fz_malloc'.  */
+};
+
+/* Index slot, empty if ITEM is NULL.  Keys are kept in the slots so
+   probing doesn't have to dereference items.  */
+struct slot_s {
+  uintptr_t key;
+  item_t *item;
+};
+
+/* Item of slots whose item has been unset.  Probing continues past
+   these, but they can be reused by new items.  */
+static item_t map_tombstone;
+#define MAP_TOMBSTONE (&map_tombstone)
+
 /* Map class struct.  */
 struct map_s
 {
   const class_t *__class;
-  item_t *index[MAP_INDEX_SIZE];
+  struct slot_s *index;
+  item_t **items; /* Items in insertion order, NULL where unset.  */
+  size_t capacity;
+  size_t length;
+  size_t end; /* Number of positions in ITEMS taken, including holes.  */
+  size_t used; /* Number of items and tombstones in the index.  */
+  slab_t *slabs;
+  item_t *free; /* Free small items, linked through their values.  */
+  item_t *dead; /* Unset items, freed when ITEMS is compacted.  */
   ptr_t owner;
   map_value_f init_value;
   map_value_f free_value;
@@ -49,7 +94,15 @@ static ptr_t
 map_constructor (ptr_t ptr, va_list *args)
 {
   map_t *map = (map_t *) ptr;
-  memset (map->index, 0, sizeof (item_t *) * MAP_INDEX_SIZE);
+  map->index = NULL;
+  map->items = NULL;
+  map->capacity = 0;
+  map->length = 0;
+  map->end = 0;
+  map->used = 0;
+  map->slabs = NULL;
+  map->free = NULL;
+  map->dead = NULL;
   map->owner = va_arg (*args, ptr_t);
   map->init_value = va_arg (*args, map_value_f);
   map->free_value = va_arg (*args, map_value_f);
@@ -63,19 +116,33 @@ map_destructor (ptr_t ptr)
   map_t *map = (map_t *) ptr;
 
   uint_t i;
-  item_t *item = NULL, *prev = NULL;
-  for (i = 0; i < MAP_INDEX_SIZE; ++i)
+  item_t *item;
+  slab_t *slab;
+  for (i = 0; i < map->end; ++i)
     {
-      item = map->index[i];
-      while (item)
-        {
-          if (map->free_value)
-            map->free_value (map, item->key, item + 1);
-          prev = item;
-          item = prev->next;
-          fz_free (prev);
-        }
-      map->index[i] = NULL;
+      item = map->items[i];
+      if (item == NULL)
+        continue;
+      if (map->free_value)
+        map->free_value (map, item->key, item + 1);
+      if (item->size > MAP_SMALL_SIZE)
+        fz_free (item);
+    }
+  while (map->dead)
+    {
+      item = map->dead;
+      map->dead = *((item_t **) (item + 1));
+      if (item->size > MAP_SMALL_SIZE)
+        fz_free (item);
+    }
+  fz_free (map->items);
+  fz_free (map->index);
+
+  while (map->slabs)
+    {
+      slab = map->slabs;
+      map->slabs = slab->next;
+      fz_free (slab);
     }
 
   return map;
@@ -85,11 +152,7 @@ map_destructor (ptr_t ptr)
 static size_t
 map_length (const ptr_t map)
 {
-  size_t length = 0;
-  ptr_t value = fz_map_next (map, NULL);
-  for (; value != NULL; value = fz_map_next (map, value))
-    ++length;
-  return length;
+  return ((const map_t *) map)->length;
 }
 
 /* Get given MAPs owner.  */
@@ -99,8 +162,175 @@ fz_map_owner (const map_t *map)
   return map ? map->owner : NULL;
 }
 
+/* Get the first slot to probe for KEY in MAP.  Keys are often
+   pointers, which share their low and high bits, or small integers,
+   so all bits are mixed into the slot number.  */
+static inline size_t
+map_hash (const map_t *map, uintptr_t key)
+{
+  uint64_t hash = (uint64_t) key;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return (size_t) hash & (map->capacity - 1);
+}
+
+/* Find the slot of KEY in MAP.  Returns -1 if there's none.  */
+static inline int_t
+map_find (const map_t *map, uintptr_t key)
+{
+  size_t slot;
+  const struct slot_s *s;
+
+  if (map->capacity == 0)
+    return -1;
+
+  slot = map_hash (map, key);
+  for (s = &map->index[slot]; s->item != NULL;
+       slot = (slot + 1) & (map->capacity - 1), s = &map->index[slot])
+    if (s->key == key && s->item != MAP_TOMBSTONE)
+      return (int_t) slot;
+
+  return -1;
+}
+
+/* Add ITEM to the index of MAP, which must have a free slot and must
+   not contain the key of ITEM.  Returns the slot of ITEM.  */
+static size_t
+map_put (map_t *map, item_t *item)
+{
+  size_t slot = map_hash (map, item->key);
+  while (map->index[slot].item != NULL
+         && map->index[slot].item != MAP_TOMBSTONE)
+    slot = (slot + 1) & (map->capacity - 1);
+
+  if (map->index[slot].item == NULL)
+    ++map->used;
+  map->index[slot].key = item->key;
+  map->index[slot].item = item;
+  return slot;
+}
+
+/* Allocate an item with room for a value of SIZE bytes.  Returns NULL
+   and sets `errno' on error.  */
+static item_t *
+map_alloc_item (map_t *map, size_t size)
+{
+  item_t *item;
+  slab_t *slab;
+  uint_t i;
+
+  if (size > MAP_SMALL_SIZE)
+    {
+      item = fz_malloc (sizeof (item_t) + size);
+      if (item != NULL)
+        item->size = size;
+      return item; /* `errno' is set to ENOMEM on error.  */
+    }
+
+  if (map->free == NULL)
+    {
+      slab = fz_malloc (sizeof (slab_t) + MAP_SLAB_ITEMS * MAP_SMALL_BLOCK);
+      if (slab == NULL)
+        return NULL; /* `errno' is set to ENOMEM.  */
+      slab->next = map->slabs;
+      map->slabs = slab;
+      for (i = 0; i < MAP_SLAB_ITEMS; ++i)
+        {
+          item = (item_t *) ((char *) (slab + 1) + i * MAP_SMALL_BLOCK);
+          *((item_t **) (item + 1)) = map->free;
+          map->free = item;
+        }
+    }
+
+  item = map->free;
+  map->free = *((item_t **) (item + 1));
+  item->size = MAP_SMALL_SIZE;
+  return item;
+}
+
+/* Free ITEM of MAP.  */
+static void
+map_free_item (map_t *map, item_t *item)
+{
+  if (item->size > MAP_SMALL_SIZE)
+    fz_free (item);
+  else
+    {
+      *((item_t **) (item + 1)) = map->free;
+      map->free = item;
+    }
+}
+
+/* Close the holes left in the item array of MAP by unset items, which
+   are freed now that nothing can be iterating past them.  */
+static void
+map_compact (map_t *map)
+{
+  item_t *item;
+  uint_t r, w;
+
+  for (r = 0, w = 0; r < map->end; ++r)
+    if ((item = map->items[r]) != NULL)
+      {
+        item->pos = w;
+        map->items[w++] = item;
+      }
+  map->end = w;
+
+  while (map->dead)
+    {
+      item = map->dead;
+      map->dead = *((item_t **) (item + 1));
+      map_free_item (map, item);
+    }
+}
+
+/* Compact the items of MAP and rebuild its index with room for at
+   least one more item, dropping tombstones.  The item array is resized
+   to the capacity of the index.  Returns 0 on success or a negative
+   error code on error.  */
+static int_t
+map_grow (map_t *map)
+{
+  struct slot_s *index;
+  item_t **items;
+  size_t capacity = MAP_MIN_CAPACITY;
+  uint_t i;
+
+  map_compact (map);
+  while ((map->length + 1) * 2 > capacity)
+    capacity <<= 1;
+
+  index = fz_malloc (capacity * sizeof (struct slot_s));
+  if (index == NULL)
+    return -ENOMEM;
+
+  if (capacity != map->capacity)
+    {
+      items = fz_realloc (map->items, capacity * sizeof (item_t *));
+      if (items == NULL)
+        {
+          fz_free (index);
+          return -ENOMEM;
+        }
+      map->items = items;
+    }
+
+  memset (index, 0, capacity * sizeof (struct slot_s));
+  fz_free (map->index);
+  map->index = index;
+  map->capacity = capacity;
+  map->used = 0;
+  for (i = 0; i < map->length; ++i)
+    map_put (map, map->items[i]);
+
+  return 0;
+}
+
 /* Get item mapped to given KEY or create it if it doesn't exist and
-   SIZE is greater than zero.  */
+   SIZE is greater than zero.  Returns NULL and sets `errno' on
+   error.  */
 static item_t *
 map_get_item (map_t *map, uintptr_t key, size_t size, bool_t *is_new)
 {
@@ -110,24 +340,28 @@ map_get_item (map_t *map, uintptr_t key, size_t size, bool_t *is_new)
       return NULL;
     }
 
-  uint_t i = key % MAP_INDEX_SIZE;
-  item_t *item = map->index[i], *prev = NULL;
-  while (item && item->key != key)
-    {
-      prev = item;
-      item = item->next;
-    }
+  int_t slot = map_find (map, key);
+  item_t *item = slot >= 0 ? map->index[slot].item : NULL;
 
   if (item)
     {
       if (size > item->size)
         {
-          item = fz_realloc (item, sizeof (item_t) + size);
-          item->size = size;
-          if (prev)
-            prev->next = item;
-          else
-            map->index[i] = item;
+          item_t *grown;
+          size_t pos = item->pos; /* ITEM is freed when it grows.  */
+          if (item->size > MAP_SMALL_SIZE)
+            grown = fz_realloc (item, sizeof (item_t) + size);
+          else if ((grown = map_alloc_item (map, size)) != NULL)
+            {
+              memcpy (grown + 1, item + 1, item->size);
+              map_free_item (map, item);
+            }
+          if (grown == NULL)
+            return NULL; /* `errno' is set to ENOMEM.  */
+          grown->key = key;
+          grown->size = size;
+          grown->pos = pos;
+          item = map->index[slot].item = map->items[pos] = grown;
         }
 
       if (is_new)
@@ -135,14 +369,25 @@ map_get_item (map_t *map, uintptr_t key, size_t size, bool_t *is_new)
     }
   else if (!item && size > 0)
     {
-      item = fz_malloc (sizeof (item_t) + size);
+      if ((map->used + 1) * 4 > map->capacity * 3)
+        {
+          if (map_grow (map) < 0)
+            {
+              errno = ENOMEM;
+              return NULL;
+            }
+        }
+      else if (map->end == map->capacity)
+        map_compact (map);
+
+      item = map_alloc_item (map, size);
+      if (item == NULL)
+        return NULL; /* `errno' is set to ENOMEM.  */
       item->key = key;
-      item->next = NULL;
-      item->size = size;
-      if (prev)
-        prev->next = item;
-      else
-        map->index[i] = item;
+      item->pos = map->end++;
+      map->items[item->pos] = item;
+      ++map->length;
+      map_put (map, item);
 
       if (is_new)
         *is_new = TRUE;
@@ -155,8 +400,14 @@ map_get_item (map_t *map, uintptr_t key, size_t size, bool_t *is_new)
 ptr_t
 fz_map_get (const map_t *map, uintptr_t key)
 {
-  item_t *item = map_get_item ((map_t *) map, key, 0, NULL);
-  return item ? item + 1 : NULL;
+  if (!map)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  int_t slot = map_find (map, key);
+  return slot >= 0 ? map->index[slot].item + 1 : NULL;
 }
 
 /* Map given VALUE of size SIZE to KEY.  */
@@ -204,26 +455,26 @@ fz_map_unset (map_t *map, uintptr_t key)
   if (!map)
     return;
 
-  uint_t i = key % MAP_INDEX_SIZE;
-  item_t *item = map->index[i], *prev = NULL;
-  while (item && item->key != key)
-    {
-      prev = item;
-      item = item->next;
-    }
+  int_t slot = map_find (map, key);
+  if (slot < 0)
+    return;
 
-  if (item)
-    {
-      if (prev)
-        prev->next = item->next;
-      else
-        map->index[i] = item->next;
+  item_t *item = map->index[slot].item;
+  map->index[slot].item = MAP_TOMBSTONE;
 
-      if (map->free_value)
-        map->free_value (map, item->key, item + 1);
+  /* Leave a hole in the item array to keep insertion order, and keep
+     ITEM until the array is compacted so that `fz_map_next' can still
+     step past it.  */
+  map->items[item->pos] = NULL;
+  --map->length;
+  while (map->end > 0 && map->items[map->end - 1] == NULL)
+    --map->end;
 
-      fz_free (item);
-    }
+  if (map->free_value)
+    map->free_value (map, item->key, item + 1);
+
+  *((item_t **) (item + 1)) = map->dead;
+  map->dead = item;
 }
 
 /* Get the key of given VALUE in MAP.  */
@@ -236,7 +487,10 @@ fz_map_key (const ptr_t value)
   return 0;
 }
 
-/* Get next value in relation to PREV from MAP.  */
+/* Get next value in relation to PREV from MAP, or the first value if
+   PREV is NULL.  Values are iterated in the order they were first set
+   in.  Values, including PREV, can be unset while iterating.  New
+   keys can only be set while iterating if PREV is still set.  */
 ptr_t
 fz_map_next (const map_t *map, const ptr_t prev)
 {
@@ -246,21 +500,10 @@ fz_map_next (const map_t *map, const ptr_t prev)
       return NULL;
     }
 
-  uint_t i = 0;
-  if (prev)
-    {
-      item_t *item = ((item_t *) prev) - 1;
-      if (item->next)
-        return item->next + 1;
-      else
-        i = (item->key % MAP_INDEX_SIZE) + 1;
-    }
-
-  for (; i < MAP_INDEX_SIZE; ++i)
-    if (map->index[i])
-      return map->index[i] + 1;
-
-  return NULL;
+  size_t pos = prev ? (((item_t *) prev) - 1)->pos + 1 : 0;
+  while (pos < map->end && map->items[pos] == NULL)
+    ++pos;
+  return pos < map->end ? map->items[pos] + 1 : NULL;
 }
 
 /* `map_c' class descriptor.  */
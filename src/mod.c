@@ -18,10 +18,12 @@
    <http://www.gnu.org/licenses/>.  */
 
 #include <errno.h>
+#include <string.h>
 #include "mod.h"
 #include "private-mod.h"
 #include "class.h"
 #include "list.h"
+#include "private-list.h"
 #include "malloc.h"
 
 #define MOD_NONE 0
@@ -38,12 +40,16 @@ mod_constructor (ptr_t ptr, va_list *args)
 {
   (void) args;
   mod_t *self = (mod_t *) ptr;
-  self->stepbuf = fz_new_simple_vector (real_t);
-  self->modbuf = fz_new_simple_vector (real_t);
-  self->vstates = fz_new_simple_vector (struct voice_state_s);
+  self->stepbuf = fz_new_aligned_vector (real_t);
+  self->modbuf = fz_new_aligned_vector (real_t);
+  self->states = fz_new_small_vector (struct voice_state_s,
+                                      LISTOPT_NONE);
+  fz_vstates_init (&self->vstates, 0);
+  self->state_size = 0;
   self->flags = MOD_RENDERED;
   self->render = NULL;
   self->freestate = NULL;
+  self->resetstate = NULL;
   return self;
 }
 
@@ -53,25 +59,31 @@ mod_destructor (ptr_t ptr)
 {
   mod_t *self = (mod_t *) ptr;
   uint_t i;
-  size_t nvstates = fz_len (self->vstates);
+  size_t nstates = fz_len (self->states);
   struct voice_state_s *state;
 
-  for (i = 0; i < nvstates; ++i)
+  for (i = 0; i < self->vstates.len && self->freestate; ++i)
+    if (self->vstates.epochs[i] != 0)
+      self->freestate (self, self->vstates.data + i * self->vstates.size);
+  fz_vstates_release (&self->vstates);
+
+  for (i = 0; i < nstates; ++i)
     {
-      state = fz_ref_at (self->vstates, i, struct voice_state_s);
+      state = fz_ref_at (self->states, i, struct voice_state_s);
       if (self->freestate != NULL)
         self->freestate (self, state->data);
       fz_free (state->data);
     }
 
-  fz_del (self->vstates);
+  fz_del (self->states);
   fz_del (self->modbuf);
   fz_del (self->stepbuf);
   return self;
 }
 
 /* Get state data for the given MODULATOR and VOICE. If no data
-   exists, SIZE bytes are allocetd and returned.  */
+   exists, SIZE bytes are allocetd and returned.  Returns NULL if VOICE
+   is NULL or if the state could not be allocated.  */
 ptr_t
 fz_mod_state_data (mod_t *modulator, const voice_t *voice,
                    size_t size)
@@ -80,32 +92,106 @@ fz_mod_state_data (mod_t *modulator, const voice_t *voice,
   size_t nstates;
   struct voice_state_s *state;
   struct voice_state_s newstate;
+  ptr_t data;
 
   if (modulator == NULL || voice == NULL)
     return NULL;
 
-  nstates = fz_len (modulator->vstates);
-  for (i = 0; (uint_t) i < nstates; ++i)
+  /* States of up to `state_size' bytes of voices with a slot are kept
+     at that slot in VSTATES.  A state left by an earlier owner or note
+     of the slot is reset with `resetstate', or else freed and zeroed
+     for VOICE.  */
+  if (voice->slot != VOICE_SLOT_NONE && size > 0
+      && size <= modulator->state_size)
     {
-      state = fz_ref_at (modulator->vstates, i, struct voice_state_s);
-      if (state->voice == voice)
-        return state->data;
+      if (modulator->vstates.len == 0)
+        fz_vstates_init (&modulator->vstates, modulator->state_size);
+      i = vstates_get (&modulator->vstates, voice, &data);
+      if (i < 0)
+        return NULL;
+      else if (i == VSTATE_STALE && modulator->resetstate != NULL)
+        modulator->resetstate (modulator, data);
+      else if (i == VSTATE_STALE)
+        {
+          if (modulator->freestate != NULL)
+            modulator->freestate (modulator, data);
+          memset (data, 0, modulator->vstates.size);
+        }
+      return data;
     }
 
+  nstates = fz_vector_len (modulator->states);
+  state = fz_vector_data (modulator->states, struct voice_state_s);
+  for (i = 0; (uint_t) i < nstates; ++i)
+    if (state[i].voice == voice)
+      return state[i].data;
+
   if (size == 0)
     return NULL;
 
   newstate.voice = voice;
   newstate.data = fz_malloc (size);
+  if (newstate.data == NULL)
+    return NULL;
 
-  i = fz_push_one (modulator->vstates, &newstate);
+  i = fz_push_one (modulator->states, &newstate);
   if (i >= 0)
-    return fz_ref_at (modulator->vstates, i,
+    return fz_ref_at (modulator->states, i,
                       struct voice_state_s)->data;
 
+  fz_free (newstate.data);
   return NULL;
 }
 
+/* Allocate and pre-fault the buffers of SELF for NFRAMES frames and
+   its state for each voice in VOICES (which may be NULL), and lock
+   them into memory if LOCK is TRUE.  Returns 0 on success or a
+   negative error code on error.  */
+int_t
+fz_mod_reserve (mod_t *self, size_t nframes, const list_t *voices,
+                bool_t lock)
+{
+  size_t i, nvoices = fz_len ((const ptr_t) voices);
+  ptr_t state;
+  int_t err;
+
+  if (self == NULL)
+    return -EINVAL;
+
+  if ((err = fz_reserve (self->stepbuf, nframes)) < 0
+      || (err = fz_reserve (self->modbuf, nframes)) < 0
+      || (self->state_size > 0
+          && (err = fz_reserve (self->states, nvoices)) < 0))
+    return err;
+
+  if ((err = fz_list_prefault (self->stepbuf, lock)) < 0
+      || (err = fz_list_prefault (self->modbuf, lock)) < 0)
+    return err;
+
+  /* Make room for the states of all voice slots in use, like
+     `fz_node_reserve'.  */
+  if (self->state_size > 0)
+    {
+      if (self->vstates.len == 0)
+        fz_vstates_init (&self->vstates, self->state_size);
+      err = fz_vstates_reserve (&self->vstates, fz_voice_slots_len ());
+      if (err < 0)
+        return err;
+    }
+
+  for (i = 0; i < nvoices && self->state_size > 0; ++i)
+    {
+      state = fz_mod_state_data (self, fz_ref_at (voices, i, voice_t),
+                                 self->state_size);
+      if (state == NULL)
+        return -ENOMEM;
+      if ((err = fz_prefault (state, self->state_size, lock)) < 0)
+        return err;
+    }
+
+  return 0;
+}
+
 /* Prepare SELF for `fz_mod_render' to render NFRAMES new frames.  */
 void
 fz_mod_prepare (mod_t *self, size_t nframes)
@@ -114,8 +200,10 @@ fz_mod_prepare (mod_t *self, size_t nframes)
     return;
 
   self->flags &= ~MOD_RENDERED;
-  fz_clear (self->stepbuf, nframes);
-  fz_clear (self->modbuf, nframes);
+  /* Renderers overwrite the whole buffer so the frames from the
+     previous block are left as they are.  */
+  fz_resize (self->stepbuf, nframes);
+  fz_resize (self->modbuf, nframes);
 }
 
 /* Render NFRAMES of node modulation input into MOD buffer.  */
@@ -127,7 +215,7 @@ fz_mod_render (mod_t *self, const voice_t *voice)
   if (self == NULL)
     return -EINVAL;
 
-  nframes = fz_len (self->stepbuf);
+  nframes = fz_vector_len (self->stepbuf);
 
   if (self->flags & MOD_RENDERED)
     return nframes;
@@ -152,15 +240,13 @@ fz_mod_apply (const mod_t *self, list_t *out, real_t lo, real_t up)
   real_t range = up - lo;
   uint_t i;
 
-  if (self == NULL || out == NULL)
+  if (self == NULL || !fz_is_vector (out))
     return -EINVAL;
 
-  modsize = fz_len (self->stepbuf);
-  outsize = fz_len (out);
-  moddata = (real_t *) fz_list_data (self->stepbuf);
-  outdata = (real_t *) fz_list_data (out);
-  if (outdata == NULL)
-    return -EINVAL; /* OUT is not a vector.  */
+  modsize = fz_vector_len (self->stepbuf);
+  outsize = fz_vector_len (out);
+  moddata = fz_vector_data (self->stepbuf, real_t);
+  outdata = fz_vector_data (out, real_t);
 
   napplied = (modsize < outsize ? modsize : outsize);
   for (i = 0; i < napplied; ++i)
@@ -180,9 +266,9 @@ fz_modulate (const mod_t *self, real_t seed, real_t lo, real_t up)
   if (self == NULL)
     return NULL;
 
-  fz_clear (self->modbuf, fz_len (self->stepbuf));
-  moddata = (real_t *) fz_list_data (self->modbuf);
-  modsize = fz_len (self->modbuf);
+  fz_resize (self->modbuf, fz_vector_len (self->stepbuf));
+  moddata = fz_vector_data (self->modbuf, real_t);
+  modsize = fz_vector_len (self->modbuf);
 
   for (i = 0; i < modsize; ++i)
     moddata[i] = seed;
@@ -34,6 +34,7 @@ __BEGIN_DECLS
 
 typedef struct mod_s mod_t;
 
+extern int_t fz_mod_reserve (mod_t *, size_t, const list_t *, bool_t);
 extern void fz_mod_prepare (mod_t *, size_t);
 extern int_t fz_mod_render (mod_t *, const voice_t *);
 extern int_t fz_mod_apply (const mod_t *, list_t *, real_t, real_t);
@@ -25,6 +25,7 @@
 #include "malloc.h"
 #include "class.h"
 #include "list.h"
+#include "private-list.h"
 #include "map.h"
 #include "mod.h"
 
@@ -62,9 +63,12 @@ node_constructor (ptr_t ptr, va_list *args)
   node_t *self = (node_t *) ptr;
   self->mods = fz_new (map_c, self, NULL, NULL);
   self->states = fz_new (map_c, self, state_init, state_free);
+  fz_vstates_init (&self->vstates, 0);
   self->state_size = 0;
   self->state_init = NULL;
   self->state_free = NULL;
+  self->state_reset = NULL;
+  self->state_prefault = NULL;
   self->render = NULL;
   return self;
 }
@@ -75,23 +79,64 @@ node_destructor (ptr_t ptr)
 {
   node_t *self = (node_t *) ptr;
   modconn_t *conn;
+  uint_t i;
 
   /* Modulators are retained in `fz_node_connect'.  */
   fz_map_each (self->mods, conn)
     fz_del (conn->mod);
 
+  for (i = 0; i < self->vstates.len && self->state_free; ++i)
+    if (self->vstates.epochs[i] != 0)
+      self->state_free (self, NULL,
+                        self->vstates.data + i * self->vstates.size);
+  fz_vstates_release (&self->vstates);
   fz_del (self->states);
   fz_del (self->mods);
   return self;
 }
 
-/* Get state data for the given NODE and VOICE.  */
+/* Get state data for the given NODE and VOICE.  Returns NULL if NODE
+   has no state, or sets `errno' to ENOMEM and returns NULL if a new
+   state could not be allocated.  */
 ptr_t
 fz_node_state (node_t *node, const voice_t *voice)
 {
   if (!node || !voice || node->state_size == 0)
     return NULL;
 
+  /* Voices with a slot have their state at that slot in VSTATES and
+     are not retained.  A state left by an earlier owner or note of the
+     slot is reset with `state_reset', or else freed and initialized
+     for VOICE, without passing the earlier owner to `state_free' since
+     it may be gone.  */
+  if (voice->slot != VOICE_SLOT_NONE)
+    {
+      ptr_t state;
+      int_t err;
+      if (node->vstates.len == 0)
+        fz_vstates_init (&node->vstates, node->state_size);
+      err = vstates_get (&node->vstates, voice, &state);
+      if (err < 0)
+        {
+          errno = -err;
+          return NULL;
+        }
+      else if (err == VSTATE_STALE && node->state_reset)
+        {
+          node->state_reset (node, (voice_t *) voice, state);
+          return state;
+        }
+      else if (err == VSTATE_STALE)
+        {
+          if (node->state_free)
+            node->state_free (node, NULL, state);
+          memset (state, 0, node->state_size);
+        }
+      if (err != VSTATE_HIT && node->state_init)
+        node->state_init (node, (voice_t *) voice, state);
+      return state;
+    }
+
   uintptr_t key = (uintptr_t) voice;
   ptr_t state = fz_map_get (node->states, key);
   if (!state)
@@ -100,6 +145,40 @@ fz_node_state (node_t *node, const voice_t *voice)
   return state;
 }
 
+/* Allocate and pre-fault the state of NODE for VOICE ahead of
+   rendering, with room for the states of all voice slots in use, and
+   lock it into memory if LOCK is TRUE.  Returns 0 on
+   success or a negative error code on error.  */
+int_t
+fz_node_reserve (node_t *node, const voice_t *voice, bool_t lock)
+{
+  ptr_t state;
+  int_t err;
+
+  if (!node || !voice)
+    return -EINVAL;
+  else if (node->state_size == 0)
+    return 0;
+
+  /* Make room for the states of all voice slots in use, so that states
+     don't move when other voices are rendered for the first time.  */
+  if (node->vstates.len == 0)
+    fz_vstates_init (&node->vstates, node->state_size);
+  err = fz_vstates_reserve (&node->vstates, fz_voice_slots_len ());
+  if (err < 0)
+    return err;
+
+  state = fz_node_state (node, voice);
+  if (!state)
+    return -ENOMEM;
+
+  err = fz_prefault (state, node->state_size, lock);
+  if (err == 0 && node->state_prefault)
+    err = node->state_prefault (node, state, lock);
+
+  return err;
+}
+
 /* Return modulator arg pointer for given SLOT.  */
 ptr_t
 fz_node_modargs (const node_t *self, uint_t slot)
@@ -138,6 +217,9 @@ fz_node_connect (node_t *node, mod_t *mod, uint_t slot, ptr_t args)
 
   modconn_t *conn = fz_map_set (node->mods, slot, NULL,
                                 sizeof (modconn_t));
+  if (!conn)
+    return ENOMEM;
+
   conn->mod = mod;
   conn->args = args;
   fz_retain (conn->mod);
@@ -174,10 +256,10 @@ fz_node_render (node_t *node,
                 list_t *frames,
                 const voice_t *voice)
 {
-  if (!node || !frames || !fz_instance_of (frames, vector_c))
+  if (!node || !fz_is_vector (frames))
     return -EINVAL;
 
-  size_t nframes = fz_len (frames);
+  size_t nframes = fz_vector_len (frames);
   if (node->render && nframes > 0)
     return node->render (node, frames, voice);
 
@@ -0,0 +1,157 @@
+/* Private header file exposing list class structs.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef FZ_PRIV_LIST_H
+#define FZ_PRIV_LIST_H 1
+
+#include <assert.h>
+#include "list.h"
+#include "class.h"
+
+__BEGIN_DECLS
+
+/* Abstract list class struct.  */
+struct list_s
+{
+  const class_t *__class;
+  size_t type_size;
+  char *type_name;
+  flags_t flags;
+  int_t (*insert) (list_t *, uint_t, uint_t, ptr_t);
+  int_t (*erase) (list_t *, uint_t, uint_t);
+  ptr_t (*at) (const list_t *, uint_t);
+  int_t (*sort) (list_t *, cmp_f);
+  int_t (*reserve) (list_t *, size_t);
+  size_t (*capacity) (const list_t *);
+  int_t (*shrink) (list_t *);
+};
+
+/* Concrete random access list class struct.  */
+typedef struct
+{
+  list_t __parent;
+  ptr_t items;
+  ptr_t store; /* Inline storage of small vectors, or NULL.  */
+  size_t length;
+  size_t capacity;
+  struct vector_slot_s *slots; /* Pointer index, see LISTOPT_INDEX.  */
+  size_t nslots;
+} vector_t;
+
+/* Concrete ring buffer class struct.  CAPACITY is zero or a power of
+   two and item I is stored at (HEAD + I) & (CAPACITY - 1).  */
+typedef struct
+{
+  list_t __parent;
+  ptr_t items;
+  size_t head;
+  size_t length;
+  size_t capacity;
+} ringbuf_t;
+
+/* The accessors below skip the class dispatch and (unless NDEBUG is
+   defined) only assert what `fz_at' checks at run time, so callers
+   must know that LIST is a `vector_c' instance, for instance by
+   checking `fz_is_vector' once before a loop.  */
+
+#define fz_is_vector(list) \
+  ((list) != NULL \
+   && (*((const class_t * const *) (list)) == vector_c \
+       || *((const class_t * const *) (list)) == small_vector_c))
+
+#define fz_vector_len(list) \
+  (((const vector_t *) (list))->length)
+
+/* Raw item storage of vector LIST as a TYPE array.  */
+#define fz_vector_data(list, type) \
+  ((type *) ((const vector_t *) (list))->items)
+
+/* Reference to item INDEX in value vector LIST.  */
+#define fz_vector_ref_at(list, index, type) \
+  ((type *) vector_check (list, index, sizeof (type), FALSE))
+
+#define fz_vector_val_at(list, index, type) \
+  (*fz_vector_ref_at (list, index, type))
+
+/* Item INDEX in pointer vector LIST (see LISTOPT_PTRS).  */
+#define fz_vector_ptr_at(list, index, type) \
+  (*((type **) vector_check (list, index, sizeof (type *), TRUE)))
+
+/* Get the address of item INDEX in LIST after asserting that it
+   exists and has the expected SIZE and pointer option.  */
+static inline ptr_t
+vector_check (const list_t *list, uint_t index, size_t size, bool_t ptrs)
+{
+  const vector_t *vector = (const vector_t *) list;
+  assert (fz_is_vector (list));
+  assert (index < vector->length);
+  assert (list->type_size == size);
+  assert (((list->flags & LISTOPT_PTRS) ? TRUE : FALSE) == ptrs);
+  (void) size;
+  (void) ptrs;
+  return (char *) vector->items + (size_t) index * size;
+}
+
+/* Define static functions for vectors of TYPE, which operate on plain
+   `vector_c' and `small_vector_c' instances:
+
+     size_t NAME_len (const list_t *list);
+     TYPE *NAME_data (const list_t *list);
+     TYPE NAME_at (const list_t *list, uint_t index);
+     TYPE *NAME_ref (const list_t *list, uint_t index);
+
+   Item addresses are computed from sizeof (TYPE) rather than the item
+   size stored in the list, so loops over NAME_data compile to plain
+   array code that the compiler can unroll and vectorize.  The checks
+   are asserts, like for the accessors above.  */
+#define FZ_VECTOR_DEFINE(name, type)                                    \
+  static inline size_t                                                  \
+  name##_len (const list_t *list)                                       \
+  {                                                                     \
+    assert (fz_is_vector (list) && list->type_size == sizeof (type));   \
+    return ((const vector_t *) list)->length;                           \
+  }                                                                     \
+                                                                        \
+  static inline type *                                                  \
+  name##_data (const list_t *list)                                      \
+  {                                                                     \
+    assert (fz_is_vector (list) && list->type_size == sizeof (type));   \
+    return (type *) ((const vector_t *) list)->items;                   \
+  }                                                                     \
+                                                                        \
+  static inline type                                                    \
+  name##_at (const list_t *list, uint_t index)                          \
+  {                                                                     \
+    assert (index < name##_len (list));                                 \
+    return name##_data (list)[index];                                   \
+  }                                                                     \
+                                                                        \
+  static inline type *                                                  \
+  name##_ref (const list_t *list, uint_t index)                         \
+  {                                                                     \
+    assert (index < name##_len (list));                                 \
+    return name##_data (list) + index;                                  \
+  }
+
+/* Sample buffers, edge weights and modulation steps.  */
+FZ_VECTOR_DEFINE (real_vector, real_t)
+
+__END_DECLS
+
+#endif /* ! FZ_PRIV_LIST_H */
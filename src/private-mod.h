@@ -24,6 +24,7 @@
 #include "class.h"
 #include "list.h"
 #include "voice.h"
+#include "private-voice.h"
 
 __BEGIN_DECLS
 
@@ -36,10 +37,13 @@ struct mod_s
   const class_t *__class;
   list_t *stepbuf;
   list_t *modbuf;
-  list_t *vstates;
+  vstates_t vstates; /* States of voices with slots.  */
+  list_t *states; /* States of other voices.  */
+  size_t state_size;
   flags_t flags;
   int_t (*render) (mod_t *, const voice_t *);
   void (*freestate) (mod_t *, ptr_t);
+  void (*resetstate) (mod_t *, ptr_t);
 };
 
 extern ptr_t fz_mod_state_data (mod_t *, const voice_t *, size_t);
@@ -24,6 +24,7 @@
 #include "class.h"
 #include "list.h"
 #include "map.h"
+#include "private-voice.h"
 
 __BEGIN_DECLS
 
@@ -38,10 +39,13 @@ struct node_s
 {
   const class_t *__class;
   map_t *mods;
-  map_t *states;
+  vstates_t vstates; /* States of voices with slots.  */
+  map_t *states; /* States of other voices.  */
   size_t state_size;
   void (*state_init) (node_t *, voice_t *, ptr_t);
   void (*state_free) (node_t *, voice_t *, ptr_t);
+  void (*state_reset) (node_t *, voice_t *, ptr_t);
+  int_t (*state_prefault) (node_t *, ptr_t, bool_t);
   int_t (*render) (node_t *, list_t *, const voice_t *);
 };
 
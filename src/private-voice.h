@@ -0,0 +1,99 @@
+/* Private header file exposing voice class struct.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef FZ_PRIV_VOICE_H
+#define FZ_PRIV_VOICE_H 1
+
+#include "voice.h"
+#include "class.h"
+
+__BEGIN_DECLS
+
+/* Voices of voice pools get a slot number below VOICE_SLOTS_MAX that
+   no other live voice has.  Other voices have VOICE_SLOT_NONE.  */
+#ifndef VOICE_SLOTS_MAX
+# define VOICE_SLOTS_MAX 256
+#endif
+#define VOICE_SLOT_NONE ((uint_t) -1)
+
+/* Return values of `vstates_get'.  */
+#define VSTATE_HIT 0
+#define VSTATE_NEW 1
+#define VSTATE_STALE 2
+
+/* voice class struct.  EPOCH is unique for every slot assignment and
+   is renewed whenever a pooled voice starts over, so state tagged with
+   it can't be mistaken for state of an earlier owner or note.  */
+struct voice_s
+{
+  const class_t *__class;
+  uint_t id;
+  real_t frequency;
+  real_t velocity;
+  real_t pressure;
+  flags_t flags;
+  uint_t slot;
+  uint_t epoch;
+};
+
+/* Table of SIZE byte states indexed by voice slot.  EPOCHS tags each
+   state with the epoch of the voice it belongs to, or 0 if unused.  */
+typedef struct vstates_s
+{
+  uint_t *epochs;
+  char *data;
+  size_t size;
+  size_t len;
+} vstates_t;
+
+extern size_t fz_voice_slots_len ();
+extern void fz_vstates_init (vstates_t *, size_t);
+extern int_t fz_vstates_reserve (vstates_t *, size_t);
+extern void fz_vstates_release (vstates_t *);
+
+/* Get the state of VOICE, which must have a slot, in STATES.  Returns
+   VSTATE_HIT if the state belongs to VOICE, VSTATE_NEW if it was
+   unused and is zeroed, VSTATE_STALE if it still holds the state of
+   an earlier owner or note of the slot, which the caller has to reset,
+   or a negative error code if STATES could not grow.  The state is
+   tagged with VOICE in all but the last case.  Growing STATES moves
+   all states, so pointers to them only stay valid while voices have
+   slots below those reserved with `fz_vstates_reserve'.  */
+static inline int_t
+vstates_get (vstates_t *states, const voice_t *voice, ptr_t *state)
+{
+  uint_t slot = voice->slot;
+  int_t err;
+
+  if (slot >= states->len
+      && (err = fz_vstates_reserve (states, slot + 1)) < 0)
+    return err;
+
+  *state = states->data + (size_t) slot * states->size;
+  if (states->epochs[slot] == voice->epoch)
+    return VSTATE_HIT;
+
+  err = states->epochs[slot] == 0 ? VSTATE_NEW : VSTATE_STALE;
+  states->epochs[slot] = voice->epoch;
+  return err;
+}
+
+__END_DECLS
+
+#endif /* ! FZ_PRIV_VOICE_H */
@@ -0,0 +1,390 @@
+/* Size class slab allocator for small blocks.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include "slab.h"
+#include "malloc.h"
+
+#ifndef SLAB_TABLE_SIZE
+# define SLAB_TABLE_SIZE (1 << 14)
+#endif
+
+#define SLAB_HEADER_SIZE 64
+#define SLAB_NUM_CLASSES 15
+#define SLAB_GRAIN 16
+
+/* Blocks are linked by the index of their slab in `slab_table' and
+   their index within the slab, plus one so that zero can mark the end
+   of a list.  */
+#define SLAB_LINK(slab, block) \
+  ((((uint32_t) (slab)) << 16) | (((uint32_t) (block)) + 1))
+
+/* A class head packs an ABA tag in its upper and a block link in its
+   lower 32 bits so it can be swapped with a single CAS.  */
+#define CLASS_HEAD(tag, link) \
+  ((((uint64_t) (tag)) << 32) | (uint64_t) (link))
+
+/* Slabs are aligned to their size so the header of the slab owning a
+   block can be found by masking the block address.  */
+#define SLAB_OF(ptr) \
+  ((slab_t *) (((uintptr_t) (ptr)) & ~((uintptr_t) SLAB_SIZE - 1)))
+
+/* Slab header placed at the start of each slab.  */
+typedef struct
+{
+  const allocator_t *backend;
+  uint_t class;
+  uint_t index;
+  uint_t nblocks;
+  uint_t inuse;
+} slab_t;
+
+/* Size class struct with a lock-free list of free blocks.  */
+typedef struct
+{
+  uint64_t head;
+  size_t size;
+  size_t nslabs;
+  size_t inuse;
+} sizeclass_t;
+
+/* Block sizes (including the fz_* meta header) of each class.  */
+static sizeclass_t classes[SLAB_NUM_CLASSES] = {
+  {0, 32, 0, 0}, {0, 48, 0, 0}, {0, 64, 0, 0}, {0, 80, 0, 0},
+  {0, 96, 0, 0}, {0, 112, 0, 0}, {0, 128, 0, 0}, {0, 160, 0, 0},
+  {0, 192, 0, 0}, {0, 224, 0, 0}, {0, 256, 0, 0}, {0, 320, 0, 0},
+  {0, 384, 0, 0}, {0, 448, 0, 0}, {0, 512, 0, 0}
+};
+
+/* Smallest class fitting a block of N grains.  */
+static const unsigned char class_by_grains[] = {
+  0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+  11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14
+};
+
+/* All live slabs, indexed by the slab part of a block link.  */
+static slab_t *slab_table[SLAB_TABLE_SIZE];
+
+/* The gate counts allocations and frees in progress, and has
+   SLAB_TRIMMING set while `fz_slab_trim' runs.  Blocks freed in the
+   meantime are kept on the pending list, linked through their first
+   word, until trimming is done.  */
+#define SLAB_TRIMMING (1U << 31)
+static uint_t slab_gate;
+static ptr_t slab_pending;
+
+/* Enter the gate unless a trim is running.  Returns TRUE on success,
+   in which case `slab_leave' must be called when done.  */
+static inline bool_t
+slab_enter ()
+{
+  if (__atomic_add_fetch (&slab_gate, 1, __ATOMIC_ACQ_REL)
+      & SLAB_TRIMMING)
+    {
+      __atomic_sub_fetch (&slab_gate, 1, __ATOMIC_RELEASE);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Leave the gate entered with `slab_enter'.  */
+static inline void
+slab_leave ()
+{
+  __atomic_sub_fetch (&slab_gate, 1, __ATOMIC_RELEASE);
+}
+
+/* Get address of block INDEX in SLAB.  */
+static inline ptr_t
+slab_block (const slab_t *slab, uint_t index)
+{
+  return ((char *) slab) + SLAB_HEADER_SIZE
+    + (index * classes[slab->class].size);
+}
+
+/* Get address of block linked to by LINK.  */
+static inline ptr_t
+slab_link_block (uint32_t link)
+{
+  return slab_block (slab_table[link >> 16], (link & 0xffff) - 1);
+}
+
+/* Push the chain of blocks FIRST to LAST onto the list of CLASS.  */
+static void
+class_push (sizeclass_t *class, ptr_t first, ptr_t last)
+{
+  slab_t *slab = SLAB_OF (first);
+  uint32_t link = SLAB_LINK (slab->index,
+                             (((char *) first) - ((char *) slab)
+                              - SLAB_HEADER_SIZE) / class->size);
+  uint64_t curr = __atomic_load_n (&class->head, __ATOMIC_RELAXED);
+
+  do
+    __atomic_store_n ((uint32_t *) last, (uint32_t) curr,
+                      __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n (&class->head, &curr,
+                                       CLASS_HEAD ((curr >> 32) + 1, link),
+                                       TRUE, __ATOMIC_RELEASE,
+                                       __ATOMIC_RELAXED));
+}
+
+/* Pop a free block from CLASS or return NULL if it's empty.  */
+static ptr_t
+class_pop (sizeclass_t *class)
+{
+  uint64_t curr = __atomic_load_n (&class->head, __ATOMIC_ACQUIRE);
+  uint32_t link;
+  uint32_t next;
+
+  do
+    {
+      link = (uint32_t) curr;
+      if (link == 0)
+        return NULL;
+      /* NEXT may be garbage if the block was popped concurrently but
+         then the tag has changed and the CAS will fail.  */
+      next = __atomic_load_n ((uint32_t *) slab_link_block (link),
+                              __ATOMIC_RELAXED);
+    }
+  while (!__atomic_compare_exchange_n (&class->head, &curr,
+                                       CLASS_HEAD ((curr >> 32) + 1, next),
+                                       TRUE, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE));
+
+  return slab_link_block (link);
+}
+
+/* Allocate a new slab for class INDEX from the current backend, hand
+   out its first block and put the rest on the class free list.  */
+static ptr_t
+class_grow (uint_t index)
+{
+  sizeclass_t *class = &classes[index];
+  const allocator_t *backend = fz_get_allocator ();
+  slab_t *slab;
+  slab_t *expected;
+  uint_t i;
+  uint32_t link;
+
+  slab = (slab_t *) backend->alloc (SLAB_SIZE, SLAB_SIZE);
+  if (slab == NULL)
+    return NULL;
+
+  /* Claim a slot in the slab table.  */
+  for (i = 1; i < SLAB_TABLE_SIZE; ++i)
+    {
+      expected = NULL;
+      if (__atomic_compare_exchange_n (&slab_table[i], &expected, slab,
+                                       FALSE, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_RELAXED))
+        break;
+    }
+  if (i == SLAB_TABLE_SIZE)
+    {
+      backend->free (slab, SLAB_SIZE);
+      return NULL; /* Caller falls back to the backend.  */
+    }
+
+  slab->backend = backend;
+  slab->class = index;
+  slab->index = i;
+  slab->nblocks = (SLAB_SIZE - SLAB_HEADER_SIZE) / class->size;
+  slab->inuse = 1;
+
+  /* Link blocks 1 to N - 1 and push them as one chain.  */
+  for (i = 1; i + 1 < slab->nblocks; ++i)
+    {
+      link = SLAB_LINK (slab->index, i + 1);
+      *((uint32_t *) slab_block (slab, i)) = link;
+    }
+  if (slab->nblocks > 1)
+    class_push (class, slab_block (slab, 1),
+                slab_block (slab, slab->nblocks - 1));
+
+  __atomic_add_fetch (&class->nslabs, 1, __ATOMIC_RELAXED);
+  return slab_block (slab, 0);
+}
+
+/* Allocate a block of at least LEN bytes from the smallest fitting
+   size class.  Returns NULL if LEN is too large for any class, if a
+   new slab can't be allocated or while slabs are trimmed.  */
+ptr_t
+fz_slab_alloc (size_t len)
+{
+  uint_t index;
+  ptr_t block;
+
+  if (len > SLAB_BLOCK_MAX || !slab_enter ())
+    return NULL;
+
+  index = class_by_grains[(len + SLAB_GRAIN - 1) / SLAB_GRAIN];
+  block = class_pop (&classes[index]);
+  if (block != NULL)
+    __atomic_add_fetch (&SLAB_OF (block)->inuse, 1, __ATOMIC_RELAXED);
+  else
+    block = class_grow (index);
+
+  if (block != NULL)
+    __atomic_add_fetch (&classes[index].inuse, 1, __ATOMIC_RELAXED);
+
+  slab_leave ();
+  return block;
+}
+
+/* Return BLOCK to its size class.  Called within the gate.  */
+static void
+slab_free (ptr_t block)
+{
+  slab_t *slab = SLAB_OF (block);
+  sizeclass_t *class = &classes[slab->class];
+  class_push (class, block, block);
+  __atomic_sub_fetch (&slab->inuse, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch (&class->inuse, 1, __ATOMIC_RELAXED);
+}
+
+/* Return BLOCK allocated with `fz_slab_alloc' to its size class.  The
+   block is left pending while slabs are trimmed, so this never
+   waits.  */
+void
+fz_slab_free (ptr_t block)
+{
+  if (slab_enter ())
+    {
+      slab_free (block);
+      slab_leave ();
+      return;
+    }
+
+  *((ptr_t *) block) = __atomic_load_n (&slab_pending, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n (&slab_pending, (ptr_t *) block,
+                                       block, TRUE, __ATOMIC_RELEASE,
+                                       __ATOMIC_RELAXED));
+}
+
+/* Get the usable size of BLOCK allocated with `fz_slab_alloc'.  */
+size_t
+fz_slab_capacity (const ptr_t block)
+{
+  return classes[SLAB_OF (block)->class].size;
+}
+
+/* Release slabs without any used blocks back to their backends.
+   Allocations made while this runs are served by the backend and
+   blocks freed meanwhile are returned when it's done, so other threads
+   never wait for it.  Returns the number of bytes released.  */
+size_t
+fz_slab_trim ()
+{
+  uint_t i;
+  uint_t index;
+  size_t released = 0;
+  sizeclass_t *class;
+  slab_t *slab;
+  ptr_t block;
+  ptr_t keep;
+
+  /* Close the gate and wait for allocations and frees in progress.  */
+  if (__atomic_fetch_or (&slab_gate, SLAB_TRIMMING, __ATOMIC_ACQ_REL)
+      & SLAB_TRIMMING)
+    return 0; /* Already trimming.  */
+  while (__atomic_load_n (&slab_gate, __ATOMIC_ACQUIRE) != SLAB_TRIMMING)
+    sched_yield ();
+
+  for (index = 0; index < SLAB_NUM_CLASSES; ++index)
+    {
+      /* Rebuild the free list without blocks from empty slabs.  */
+      class = &classes[index];
+      keep = NULL;
+      while ((block = class_pop (class)) != NULL)
+        {
+          if (SLAB_OF (block)->inuse == 0)
+            continue;
+          *((ptr_t *) block) = keep;
+          keep = block;
+        }
+      while (keep != NULL)
+        {
+          block = keep;
+          keep = *((ptr_t *) block);
+          class_push (class, block, block);
+        }
+    }
+
+  for (i = 1; i < SLAB_TABLE_SIZE; ++i)
+    {
+      slab = slab_table[i];
+      if (slab == NULL || slab->inuse != 0)
+        continue;
+      slab_table[i] = NULL;
+      __atomic_sub_fetch (&classes[slab->class].nslabs, 1,
+                          __ATOMIC_RELAXED);
+      slab->backend->free (slab, SLAB_SIZE);
+      released += SLAB_SIZE;
+    }
+
+  /* Open the gate and return blocks freed while trimming.  Their slabs
+     were in use, so none of them has been released.  */
+  __atomic_fetch_and (&slab_gate, ~SLAB_TRIMMING, __ATOMIC_RELEASE);
+  block = __atomic_exchange_n (&slab_pending, NULL, __ATOMIC_ACQUIRE);
+  while (block != NULL)
+    {
+      keep = *((ptr_t *) block);
+      fz_slab_free (block);
+      block = keep;
+    }
+
+  return released;
+}
+
+/* Get the number of size classes.  */
+uint_t
+fz_memclass_count ()
+{
+  return SLAB_NUM_CLASSES;
+}
+
+/* Get the block size (including meta) of size class INDEX.  */
+size_t
+fz_memclass_size (uint_t index)
+{
+  return index < SLAB_NUM_CLASSES ? classes[index].size : 0;
+}
+
+/* Check the memory usage of size class INDEX.  MEMUSAGE_DISP reports
+   the size of all blocks in use (including meta) while MEMUSAGE_SLAB
+   reports the size of all slabs reserved by the class.  */
+size_t
+fz_memusage_class (uint_t index, uint_t flags)
+{
+  size_t size = 0;
+
+  if (index >= SLAB_NUM_CLASSES)
+    return 0;
+
+  if ((flags & MEMUSAGE_DISP) || flags == 0)
+    size += __atomic_load_n (&classes[index].inuse, __ATOMIC_RELAXED)
+      * classes[index].size;
+  if (flags & MEMUSAGE_SLAB)
+    size += __atomic_load_n (&classes[index].nslabs, __ATOMIC_RELAXED)
+      * SLAB_SIZE;
+
+  return size;
+}
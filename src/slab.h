@@ -0,0 +1,45 @@
+/* Header file for the size class slab allocator.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef FZ_SLAB_H
+#define FZ_SLAB_H 1
+
+#include "defs.h"
+#include "malloc.h"
+
+#ifndef SLAB_SIZE
+# define SLAB_SIZE (64 << 10)
+#endif
+
+#define SLAB_BLOCK_MAX 512
+#define MEMUSAGE_SLAB (1 << 2)
+
+__BEGIN_DECLS
+
+extern ptr_t fz_slab_alloc (size_t);
+extern void fz_slab_free (ptr_t);
+extern size_t fz_slab_capacity (const ptr_t);
+extern size_t fz_slab_trim ();
+extern uint_t fz_memclass_count ();
+extern size_t fz_memclass_size (uint_t);
+extern size_t fz_memusage_class (uint_t, uint_t);
+
+__END_DECLS
+
+#endif /* ! FZ_SLAB_H */
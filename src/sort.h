@@ -0,0 +1,148 @@
+/* Header file with type specialized sort functions.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef FZ_SORT_H
+#define FZ_SORT_H 1
+
+#include "defs.h"
+
+__BEGIN_DECLS
+
+/* Ranges this short are insertion sorted.  */
+#ifndef SORT_INSERTION_MAX
+# define SORT_INSERTION_MAX 16
+#endif
+
+#define FZ_SORT_LESS(a, b) ((a) < (b))
+
+/* Define static functions NAME_insertion and NAME_sort for sorting an
+   array of TYPE in ascending order where LESS (A, B) is true if A
+   should be sorted before B.  LESS can be a macro, so comparisons are
+   inlined instead of going through a `cmp_f' callback.
+
+   NAME_insertion is a stable insertion sort, which is linear for
+   nearly sorted arrays such as priority lists that are sorted after
+   every update.  NAME_sort is an introsort: a median of three
+   quicksort that falls back to heapsort when it recurses too deep and
+   to insertion sort for short ranges.  */
+#define FZ_SORT_DEFINE(name, type, less)                                \
+  static inline void                                                    \
+  name##_insertion (type *items, size_t n)                              \
+  {                                                                     \
+    size_t i, j;                                                        \
+    type item;                                                          \
+    for (i = 1; i < n; ++i)                                             \
+      {                                                                 \
+        item = items[i];                                                \
+        for (j = i; j > 0 && less (item, items[j - 1]); --j)            \
+          items[j] = items[j - 1];                                      \
+        items[j] = item;                                                \
+      }                                                                 \
+  }                                                                     \
+                                                                        \
+  static inline void                                                    \
+  name##_sift (type *items, size_t root, size_t n)                      \
+  {                                                                     \
+    size_t child;                                                       \
+    type item = items[root];                                            \
+    while ((child = 2 * root + 1) < n)                                  \
+      {                                                                 \
+        if (child + 1 < n && less (items[child], items[child + 1]))     \
+          ++child;                                                      \
+        if (!less (item, items[child]))                                 \
+          break;                                                        \
+        items[root] = items[child];                                     \
+        root = child;                                                   \
+      }                                                                 \
+    items[root] = item;                                                 \
+  }                                                                     \
+                                                                        \
+  static inline void                                                    \
+  name##_intro (type *items, size_t n, size_t depth)                    \
+  {                                                                     \
+    size_t i, j, mid;                                                   \
+    type pivot;                                                         \
+    type tmp;                                                           \
+    while (n > SORT_INSERTION_MAX)                                      \
+      {                                                                 \
+        if (depth-- == 0)                                               \
+          {                                                             \
+            for (i = n / 2; i-- > 0;)                                   \
+              name##_sift (items, i, n);                                \
+            for (i = n - 1; i > 0; --i)                                 \
+              {                                                         \
+                tmp = items[0], items[0] = items[i], items[i] = tmp;    \
+                name##_sift (items, 0, i);                              \
+              }                                                         \
+            return;                                                     \
+          }                                                             \
+                                                                        \
+        /* The median of three also stops both partition scans.  */    \
+        mid = n / 2;                                                    \
+        if (less (items[mid], items[0]))                                \
+          tmp = items[0], items[0] = items[mid], items[mid] = tmp;      \
+        if (less (items[n - 1], items[mid]))                            \
+          {                                                             \
+            tmp = items[mid], items[mid] = items[n - 1];                \
+            items[n - 1] = tmp;                                         \
+            if (less (items[mid], items[0]))                            \
+              tmp = items[0], items[0] = items[mid], items[mid] = tmp;  \
+          }                                                             \
+        pivot = items[mid];                                             \
+                                                                        \
+        for (i = 0, j = n - 1;; ++i, --j)                               \
+          {                                                             \
+            while (less (items[i], pivot))                              \
+              ++i;                                                      \
+            while (less (pivot, items[j]))                              \
+              --j;                                                      \
+            if (i >= j)                                                 \
+              break;                                                    \
+            tmp = items[i], items[i] = items[j], items[j] = tmp;        \
+          }                                                             \
+                                                                        \
+        /* Recurse into the shorter half and loop on the longer.  */    \
+        if (j + 1 < n - (j + 1))                                        \
+          {                                                             \
+            name##_intro (items, j + 1, depth);                         \
+            items += j + 1;                                             \
+            n -= j + 1;                                                 \
+          }                                                             \
+        else                                                            \
+          {                                                             \
+            name##_intro (items + j + 1, n - (j + 1), depth);           \
+            n = j + 1;                                                  \
+          }                                                             \
+      }                                                                 \
+    name##_insertion (items, n);                                        \
+  }                                                                     \
+                                                                        \
+  static inline void                                                    \
+  name##_sort (type *items, size_t n)                                   \
+  {                                                                     \
+    size_t depth = 0;                                                   \
+    size_t m;                                                           \
+    for (m = n; m > 1; m >>= 1)                                         \
+      depth += 2;                                                       \
+    name##_intro (items, n, depth);                                     \
+  }
+
+__END_DECLS
+
+#endif /* ! FZ_SORT_H */
@@ -25,6 +25,10 @@
 #include "malloc.h"
 #include "class.h"
 #include "list.h"
+#include "private-list.h"
+#include "map.h"
+#include "private-voice.h"
+#include "sort.h"
 
 #define VOICE_FLAG_NONE 0
 #define VOICE_FLAG_PRESSED (1 << 0)
@@ -33,22 +37,26 @@
 
 #define VPOOL_STACK_CAPACITY 32
 
+/* Active voices with ids below VPOOL_IDS, such as MIDI note numbers,
+   are looked up in a table, others in a map.  */
+#ifndef VPOOL_IDS
+# define VPOOL_IDS 128
+#endif
+
 #define FREQ_BY_ID(id) \
   (A4_FREQ * pow (TWELFTH_ROOT_OF_TWO, ((int_t) (id)) - A4_ID))
 
+#define VOICE_SLOTS_BITS (8 * sizeof (unsigned long))
+
 /* Global sample rate.  */
 static real_t global_sample_rate = DEFAULT_SAMPLE_RATE;
 
-/* voice class struct.  */
-struct voice_s
-{
-  const class_t *__class;
-  uint_t id;
-  real_t frequency;
-  real_t velocity;
-  real_t pressure;
-  flags_t flags;
-};
+/* Bitmap of the voice slots in use, see `voice_slot_claim'.  */
+static unsigned long voice_slots[(VOICE_SLOTS_MAX + VOICE_SLOTS_BITS - 1)
+                                 / VOICE_SLOTS_BITS];
+
+/* Last assigned voice epoch.  */
+static uint_t voice_epoch = 0;
 
 /* voice pool class struct.  */
 struct vpool_s
@@ -56,8 +64,11 @@ struct vpool_s
   const class_t *__class;
   list_t *pool;
   list_t *active_voices;
+  list_t *voices; /* Every voice of the pool, active or not.  */
   uint_t priority;
   list_t *stack;
+  voice_t *ids[VPOOL_IDS]; /* Active voices by id.  */
+  map_t *moreids; /* Active voices with larger ids.  */
 };
 
 /* Data for stolen voices in vpool stack.  */
@@ -86,6 +97,89 @@ fz_set_sample_rate (real_t rate)
   return EINVAL;
 }
 
+/* Give VOICE a new epoch if it has a slot.  Node and modulator states
+   tagged with the old epoch are then reset the next time they're
+   used, see `vstates_get'.  This is called whenever a pooled voice
+   starts over, when it's first pressed, stolen or killed, so that no
+   state such as filter coefficients or delay lines carries over from
+   the previous note.  */
+static void
+voice_reset (voice_t *voice)
+{
+  if (voice->slot == VOICE_SLOT_NONE)
+    return;
+
+  /* Skip 0 which marks unused states.  */
+  do
+    voice->epoch = __atomic_add_fetch (&voice_epoch, 1, __ATOMIC_RELAXED);
+  while (voice->epoch == 0);
+}
+
+/* Give VOICE the lowest free slot, if any, and a new epoch.  Slots
+   are claimed and released atomically since voice pools of different
+   threads share them.  Returns the slot of VOICE, which is
+   VOICE_SLOT_NONE if all slots are taken.  */
+static uint_t
+voice_slot_claim (voice_t *voice)
+{
+  uint_t i;
+  unsigned long used, bit;
+
+  for (i = 0; i < sizeof (voice_slots) / sizeof (voice_slots[0]); ++i)
+    {
+      used = __atomic_load_n (&voice_slots[i], __ATOMIC_RELAXED);
+      while (~used != 0)
+        {
+          bit = ~used & (used + 1); /* Lowest free slot.  */
+          if ((i * VOICE_SLOTS_BITS) + __builtin_ctzl (bit)
+              >= VOICE_SLOTS_MAX)
+            break;
+          if (__atomic_compare_exchange_n (&voice_slots[i], &used,
+                                           used | bit, FALSE,
+                                           __ATOMIC_ACQ_REL,
+                                           __ATOMIC_RELAXED))
+            {
+              voice->slot = (i * VOICE_SLOTS_BITS) + __builtin_ctzl (bit);
+              voice_reset (voice);
+              return voice->slot;
+            }
+        }
+    }
+
+  return VOICE_SLOT_NONE;
+}
+
+/* Release the slot of VOICE.  */
+static void
+voice_slot_release (voice_t *voice)
+{
+  if (voice->slot == VOICE_SLOT_NONE)
+    return;
+
+  __atomic_fetch_and (&voice_slots[voice->slot / VOICE_SLOTS_BITS],
+                      ~(1UL << (voice->slot % VOICE_SLOTS_BITS)),
+                      __ATOMIC_RELEASE);
+  voice->slot = VOICE_SLOT_NONE;
+  voice->epoch = 0;
+}
+
+/* Get the number of voice slots up to and including the highest one
+   in use, or 0 if none is.  */
+size_t
+fz_voice_slots_len ()
+{
+  unsigned long used;
+  size_t i = sizeof (voice_slots) / sizeof (voice_slots[0]);
+
+  while (i-- > 0)
+    {
+      used = __atomic_load_n (&voice_slots[i], __ATOMIC_RELAXED);
+      if (used != 0)
+        return (i + 1) * VOICE_SLOTS_BITS - __builtin_clzl (used);
+    }
+  return 0;
+}
+
 /* Voice constructor.  */
 static ptr_t
 voice_constructor (ptr_t ptr, va_list *args)
@@ -97,9 +191,71 @@ voice_constructor (ptr_t ptr, va_list *args)
   self->velocity = 0;
   self->pressure = self->velocity;
   self->flags = VOICE_FLAG_NONE;
+  self->slot = VOICE_SLOT_NONE;
+  self->epoch = 0;
   return self;
 }
 
+/* Voice destructor.  */
+static ptr_t
+voice_destructor (ptr_t ptr)
+{
+  voice_slot_release ((voice_t *) ptr);
+  return ptr;
+}
+
+/* Initialize STATES for states of SIZE bytes.  */
+void
+fz_vstates_init (vstates_t *states, size_t size)
+{
+  states->epochs = NULL;
+  states->data = NULL;
+  states->size = size;
+  states->len = 0;
+}
+
+/* Make room for the states of at least the first NSLOTS voice slots
+   in STATES.  New states are unused and zeroed.  Returns 0 on success
+   or a negative error code on error.  */
+int_t
+fz_vstates_reserve (vstates_t *states, size_t nslots)
+{
+  size_t len;
+  uint_t *epochs;
+  char *data;
+
+  if (states == NULL || nslots > VOICE_SLOTS_MAX)
+    return -EINVAL;
+  else if (nslots <= states->len)
+    return 0;
+
+  for (len = 4; len < nslots; len <<= 1);
+  epochs = fz_realloc (states->epochs, len * sizeof (uint_t));
+  if (epochs == NULL)
+    return -ENOMEM;
+  states->epochs = epochs;
+  data = fz_realloc (states->data, len * states->size);
+  if (data == NULL)
+    return -ENOMEM;
+  states->data = data;
+
+  memset (epochs + states->len, 0, (len - states->len) * sizeof (uint_t));
+  memset (data + states->len * states->size, 0,
+          (len - states->len) * states->size);
+  states->len = len;
+  return 0;
+}
+
+/* Free the memory of STATES.  States in use must be cleaned up by the
+   caller first.  */
+void
+fz_vstates_release (vstates_t *states)
+{
+  fz_free (states->epochs);
+  fz_free (states->data);
+  fz_vstates_init (states, states->size);
+}
+
 /* 'Press' VOICE with a given FREQUENCY and VELOCITY.  */
 int_t
 fz_voice_press (voice_t *voice, real_t frequency, real_t velocity)
@@ -191,14 +347,24 @@ vpool_constructor (ptr_t ptr, va_list *args)
   size_t polyphony = va_arg (*args, size_t);
   self->pool = fz_new_owning_vector (voice_t *);
   self->active_voices = fz_new_owning_vector (voice_t *);
-  self->stack = fz_new_simple_vector (stack_voice_t);
+  self->voices = fz_new_pointer_vector (voice_t *);
+  self->stack = fz_new_ringbuf (stack_voice_t, LISTOPT_NONE);
+  memset (self->ids, 0, sizeof (self->ids));
+  self->moreids = fz_new (map_c, self, NULL, NULL);
+  fz_reserve (self->pool, polyphony);
+  fz_reserve (self->voices, polyphony);
   for (; polyphony > 0; --polyphony)
-    fz_push_one (self->pool, fz_new (voice_c));
+    {
+      voice_t *voice = fz_new (voice_c);
+      /* Pooled voices keep their state in slots of nodes and mods.  */
+      if (voice != NULL)
+        voice_slot_claim (voice);
+      fz_push_one (self->pool, voice);
+      fz_push_one (self->voices, voice);
+    }
   /* Pre-allocate space for active and stolen voices.  */
-  fz_clear (self->active_voices, fz_len (self->pool));
-  fz_clear (self->active_voices, 0);
-  fz_clear (self->stack, VPOOL_STACK_CAPACITY);
-  fz_clear (self->stack, 0);
+  fz_reserve (self->active_voices, fz_len (self->pool));
+  fz_reserve (self->stack, VPOOL_STACK_CAPACITY);
   self->priority = VOICE_POOL_PRIORITY_FIFO;
   return self;
 }
@@ -208,77 +374,109 @@ static ptr_t
 vpool_destructor (ptr_t ptr)
 {
   vpool_t *self = (vpool_t *) ptr;
+  fz_del (self->moreids);
+  fz_del (self->voices);
   fz_del (self->stack);
   fz_del (self->active_voices);
   fz_del (self->pool);
   return self;
 }
 
-/* Active voice sort callback for pressure priority.  */
-static int_t
-voice_compare_pressure (const ptr_t a, const ptr_t b)
+/* Active voice order for pressure priority.  */
+#define VOICE_LESS_PRESSURE(a, b) ((a)->pressure < (b)->pressure)
+
+FZ_SORT_DEFINE (voice_pressure, voice_t *, VOICE_LESS_PRESSURE)
+
+FZ_VECTOR_DEFINE (voice_vector, voice_t *)
+
+/* Get the active voice with ID in POOL, or NULL if there's none.  */
+static inline voice_t *
+vpool_get_active_voice (const vpool_t *pool, uint_t id)
 {
-  const voice_t *va = *(const voice_t **) a;
-  const voice_t *vb = *(const voice_t **) b;
-  if (va->pressure < vb->pressure)
-    return -1;
-  else if (vb->pressure < va->pressure)
-    return 1;
+  voice_t **ref;
+
+  if (pool == NULL)
+    return NULL;
+  else if (id < VPOOL_IDS)
+    return pool->ids[id];
+
+  ref = fz_map_get (pool->moreids, id);
+  return ref != NULL ? *ref : NULL;
+}
+
+/* Make VOICE the active voice with ID in POOL.  Returns 0 on success
+   or ENOMEM if a large ID could not be added.  */
+static inline int_t
+vpool_set_active_voice (vpool_t *pool, uint_t id, voice_t *voice)
+{
+  if (id < VPOOL_IDS)
+    pool->ids[id] = voice;
+  else if (fz_map_set (pool->moreids, id, voice, 0) == NULL)
+    return ENOMEM;
   return 0;
 }
 
+/* Remove VOICE from the active voices by id in POOL.  */
+static inline void
+vpool_unset_active_voice (vpool_t *pool, const voice_t *voice)
+{
+  if (vpool_get_active_voice (pool, voice->id) != voice)
+    return; /* Another voice has been given the same id.  */
+  else if (voice->id < VPOOL_IDS)
+    pool->ids[voice->id] = NULL;
+  else
+    fz_map_unset (pool->moreids, voice->id);
+}
+
+/* Predicate for killed voices.  */
+static bool_t
+voice_is_killed (const ptr_t voice, ptr_t data)
+{
+  (void) data;
+  return (((const voice_t *) voice)->flags & VOICE_FLAG_KILLED)
+    ? TRUE : FALSE;
+}
+
+/* Predicate for stolen voices with the ID pointed to by DATA.  */
+static bool_t
+stack_voice_has_id (const ptr_t stolen, ptr_t data)
+{
+  return ((const stack_voice_t *) stolen)->id == *((uint_t *) data)
+    ? TRUE : FALSE;
+}
+
 /* Prioritize active voices in POOL.  */
 static inline void
 vpool_prioritize (vpool_t *pool)
 {
   /* Move killed voices back to pool.  */
-  voice_t *voice;
-  int_t i = ((int_t) fz_len (pool->active_voices)) - 1;
-  for (; i >= 0; --i)
+  uint_t i;
+  size_t nactive = voice_vector_len (pool->active_voices);
+  int_t nalive = fz_partition (pool->active_voices, voice_is_killed, NULL);
+  if (nalive >= 0 && (size_t) nalive < nactive)
     {
-      voice = fz_ref_at (pool->active_voices, i, voice_t);
-      if (voice->flags & VOICE_FLAG_KILLED)
+      for (i = nalive; i < nactive; ++i)
         {
+          voice_t *voice = voice_vector_at (pool->active_voices, i);
           voice->flags &= ~VOICE_FLAG_KILLED;
-          fz_retain (voice);
-          fz_erase_one (pool->active_voices, i);
-          fz_push_one (pool->pool, voice);
+          vpool_unset_active_voice (pool, voice);
         }
+      fz_transfer (pool->pool, pool->active_voices, nalive,
+                   nactive - nalive);
     }
 
-  /* Prioritize remaining active voices.  */
-  cmp_f prioritizer;
+  /* Prioritize remaining active voices.  Priorities change little
+     between calls, so a stable insertion sort is close to linear and
+     keeps the FIFO order of voices with equal pressure.  */
   switch (pool->priority)
     {
     case VOICE_POOL_PRIORITY_PRESSURE:
-      prioritizer = voice_compare_pressure;
+      voice_pressure_insertion (voice_vector_data (pool->active_voices),
+                                voice_vector_len (pool->active_voices));
       break;
     default: /* VOICE_POOL_PRIORITY_FIFO */
-      prioritizer = NULL;
       break;
     }
-  if (prioritizer != NULL)
-    fz_sort (pool->active_voices, prioritizer);
-}
-
-/* Get active voice from given POOL by ID.  */
-static inline voice_t *
-vpool_get_active_voice (const vpool_t *pool, uint_t id)
-{
-  if (pool == NULL)
-    return NULL;
-
-  uint_t i;
-  voice_t *voice = NULL;
-  size_t nvoices = fz_len (pool->active_voices);
-  for (i = 0; i < nvoices; ++i)
-    {
-      voice = fz_ref_at (pool->active_voices, i, voice_t);
-      if (voice->id == id)
-        return voice;
-    }
-
-  return NULL;
 }
 
 /* Get index of active voice to steal.  */
@@ -289,13 +487,11 @@ vpool_get_steal_voice_index (const vpool_t *pool)
     return -1;
 
   uint_t i;
-  size_t nvoices = fz_len (pool->active_voices);
+  voice_t *const *voices = voice_vector_data (pool->active_voices);
+  size_t nvoices = voice_vector_len (pool->active_voices);
   for (i = 0; i < nvoices; ++i)
-    {
-      if (!fz_voice_pressed (fz_ref_at (pool->active_voices, i,
-                                        voice_t)))
-        return i;
-    }
+    if (!fz_voice_pressed (voices[i]))
+      return i;
 
   if (nvoices > 0)
     return 0;
@@ -303,7 +499,8 @@ vpool_get_steal_voice_index (const vpool_t *pool)
   return -1;
 }
 
-/* Press a voice from POOL.  */
+/* Press a voice from POOL.  Returns ENOMEM, leaving no voice pressed
+   for ID, if ID could not be added to the active ids.  */
 int_t
 fz_vpool_press (vpool_t *pool, uint_t id, real_t velocity)
 {
@@ -321,6 +518,8 @@ fz_vpool_press (vpool_t *pool, uint_t id, real_t velocity)
     {
       if (fz_voice_pressed (voice))
         return EINVAL;
+      /* The active voices are bounded by the polyphony and moving one
+         is linear anyway, so a plain search is good enough here.  */
       i = fz_index_of (pool->active_voices, voice, fz_cmp_ptr);
       if (nactive > 1 && (uint_t) i < nactive - 1)
         {
@@ -354,19 +553,32 @@ fz_vpool_press (vpool_t *pool, uint_t id, real_t velocity)
       voice = fz_ref_at (pool->active_voices, i, voice_t);
       fz_retain (voice);
       fz_erase_one (pool->active_voices, i);
+      vpool_unset_active_voice (pool, voice);
       if (fz_voice_pressed (voice))
         {
           /* If the stolen voice is still pressed we'll remember it
              and possibly revive it later.  */
           stolen.id = voice->id;
           stolen.pressure = voice->pressure;
+          /* Forget the oldest stolen voice rather than growing the
+             stack.  Erasing the front of a ring buffer is O(1).  */
+          if (fz_len (pool->stack) >= VPOOL_STACK_CAPACITY)
+            fz_erase_one (pool->stack, 0);
           fz_push_one (pool->stack, &stolen);
           fz_voice_release (voice);
         }
     }
 
+  /* VOICE is either idle or stolen and starts over.  If it can't be
+     found by ID it goes back to the idle voices.  */
+  voice_reset (voice);
   voice->id = id;
   voice->flags &= ~VOICE_FLAG_REPOSSESSED;
+  if (vpool_set_active_voice (pool, id, voice) != 0)
+    {
+      fz_push_one (pool->pool, voice);
+      return ENOMEM;
+    }
   fz_push_one (pool->active_voices, voice);
   return fz_voice_press (voice, frequency, velocity);
 }
@@ -379,23 +591,31 @@ fz_vpool_release (vpool_t *pool, uint_t id)
     return EINVAL;
 
   voice_t *voice = vpool_get_active_voice (pool, id);
-  int_t i;
   size_t nstolen = fz_len (pool->stack);
   stack_voice_t *stolen;
   if (voice == NULL)
     {
-      for (i = nstolen - 1; i >= 0; --i)
-        {
-          stolen = fz_ref_at (pool->stack, i, stack_voice_t);
-          if (stolen->id == id)
-            fz_erase_one (pool->stack, i);
-        }
+      fz_erase_if (pool->stack, stack_voice_has_id, &id);
       return 0;
     }
 
-  if (nstolen > 0)
+  /* Drop stolen ids that have been pressed again since, so that no
+     two active voices share an id.  */
+  while (nstolen > 0)
     {
       stolen = fz_ref_at (pool->stack, nstolen - 1, stack_voice_t);
+      if (vpool_get_active_voice (pool, stolen->id) == NULL)
+        break;
+      fz_erase_one (pool->stack, --nstolen);
+    }
+
+  /* The stolen id is added before the current one is dropped, so
+     VOICE keeps its id if that fails.  */
+  if (nstolen > 0)
+    {
+      if (vpool_set_active_voice (pool, stolen->id, voice) != 0)
+        return ENOMEM;
+      vpool_unset_active_voice (pool, voice);
       voice->id = stolen->id;
       voice->pressure = stolen->pressure;
       voice->frequency = FREQ_BY_ID (voice->id);
@@ -414,12 +634,11 @@ fz_vpool_kill (vpool_t *pool, voice_t *voice)
   if (!pool || !voice)
     return EINVAL;
 
-  int_t index = fz_index_of (pool->active_voices, (ptr_t) voice,
-                             fz_cmp_ptr);
-  if (index >= 0)
+  if (vpool_get_active_voice (pool, voice->id) == voice)
     {
       fz_voice_release (voice);
       voice->flags |= VOICE_FLAG_KILLED;
+      voice_reset (voice);
     }
 
   return 0;
@@ -449,6 +668,13 @@ fz_vpool_voices (vpool_t *pool)
   return pool->active_voices;
 }
 
+/* Get all voices of POOL, active or not.  */
+const list_t *
+fz_vpool_all_voices (const vpool_t *pool)
+{
+  return pool ? pool->voices : NULL;
+}
+
 /* Interpret a string represented NOTE as a Hz frequency.  */
 real_t
 fz_note_frequency (const char *note)
@@ -505,7 +731,7 @@ fz_note_frequency (const char *note)
 static const class_t _voice_c = {
   sizeof (voice_t),
   voice_constructor,
-  NULL,
+  voice_destructor,
   NULL,
   NULL,
   NULL
@@ -56,6 +56,7 @@ extern int_t fz_vpool_release (vpool_t *, uint_t);
 extern int_t fz_vpool_kill (vpool_t *, voice_t *);
 extern int_t fz_vpool_kill_id (vpool_t *, uint_t);
 extern const list_t * fz_vpool_voices (vpool_t *);
+extern const list_t * fz_vpool_all_voices (const vpool_t *);
 
 extern real_t fz_note_frequency (const char *);
 
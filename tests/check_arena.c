@@ -0,0 +1,156 @@
+/* Tests for `arena.c' functions.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <stdlib.h>
+#include <check.h>
+#include <errno.h>
+#include "malloc.h"
+#include "arena.h"
+#include "slab.h"
+
+#define TEST_ARENA_SIZE (1 << 20)
+
+/* Pre-test hook.  */
+void
+setup ()
+{
+  ck_assert_int_eq (fz_memusage (0), 0);
+  ck_assert (fz_arena_reserve (TEST_ARENA_SIZE) == 0);
+  ck_assert (fz_get_allocator () == arena_allocator);
+}
+
+/* Post-test hook.  */
+void
+teardown ()
+{
+  ck_assert_int_eq (fz_memusage (0), 0);
+  ck_assert (fz_arena_release () == 0);
+  ck_assert (fz_arena_release () == -EINVAL);
+  ck_assert_int_eq (fz_arena_used (), 0);
+  ck_assert (fz_get_allocator () == malloc_allocator);
+}
+
+/* Test for `fz_arena_reserve'.  */
+START_TEST (test_fz_arena_reserve)
+{
+  ck_assert (fz_arena_size () >= TEST_ARENA_SIZE);
+  ck_assert (fz_arena_reserve (0) == -EINVAL);
+
+  /* Reservations share the arena if it's large enough.  */
+  ck_assert (fz_arena_reserve (TEST_ARENA_SIZE * 2) == -EBUSY);
+  ck_assert (fz_arena_reserve (TEST_ARENA_SIZE) == 0);
+  ck_assert (fz_arena_release () == 0);
+  ck_assert (fz_get_allocator () == arena_allocator);
+  ck_assert (fz_arena_size () >= TEST_ARENA_SIZE);
+}
+END_TEST
+
+/* Test for `fz_arena_release'.  */
+START_TEST (test_fz_arena_release)
+{
+  ptr_t ptr = fz_malloc (100);
+  ck_assert (fz_arena_release () == -EBUSY);
+  ck_assert (fz_get_allocator () == arena_allocator);
+  fz_free (ptr);
+  /* `teardown' makes the successful release.  */
+}
+END_TEST
+
+/* Test allocating from the arena.  */
+START_TEST (test_arena_alloc)
+{
+  char *base;
+  ptr_t ptr;
+  ptr_t recycled;
+  int_t *ints;
+  int_t i;
+
+  ptr = fz_malloc (100);
+  ck_assert (ptr != NULL);
+  ck_assert (fz_arena_used () > 0);
+
+  /* Blocks should be placed within the arena.  */
+  base = (char *) ptr;
+  ints = fz_malloc (sizeof (int_t) * 10);
+  ck_assert ((char *) ints > base
+             && (char *) ints < base + fz_arena_size ());
+
+  /* Freed blocks of the same size should be recycled.  */
+  fz_free (ptr);
+  recycled = fz_malloc (100);
+  ck_assert (recycled == ptr);
+  fz_free (recycled);
+
+  /* Contents should survive growing a block.  */
+  for (i = 0; i < 10; ++i)
+    ints[i] = i;
+  ints = fz_realloc (ints, sizeof (int_t) * 1000);
+  for (i = 0; i < 10; ++i)
+    ck_assert (ints[i] == i);
+  fz_free (ints);
+}
+END_TEST
+
+/* Test moving blocks between backends.  */
+START_TEST (test_arena_switch)
+{
+  int_t *ints = fz_malloc (sizeof (int_t) * 4);
+  ints[3] = 3;
+  ck_assert (fz_set_allocator (malloc_allocator) == 0);
+
+  /* Growing the block should move it to the current backend.  */
+  ints = fz_realloc (ints, sizeof (int_t) * 1024);
+  ck_assert (ints[3] == 3);
+  fz_slab_trim ();
+  ck_assert_int_eq (fz_arena_used (), 0);
+  fz_free (ints);
+
+  ck_assert (fz_set_allocator (NULL) == -EINVAL);
+  ck_assert (fz_set_allocator (arena_allocator) == 0);
+}
+END_TEST
+
+/* Initiate an arena test suite struct.  */
+Suite *
+arena_suite_create ()
+{
+  Suite *s = suite_create ("arena");
+  TCase *t = tcase_create ("arena");
+  tcase_add_checked_fixture (t, setup, teardown);
+  tcase_add_test (t, test_fz_arena_reserve);
+  tcase_add_test (t, test_fz_arena_release);
+  tcase_add_test (t, test_arena_alloc);
+  tcase_add_test (t, test_arena_switch);
+  suite_add_tcase (s, t);
+  return s;
+}
+
+/* Run all arena tests.  */
+int
+main ()
+{
+  int fail_count = 0;
+  Suite *suite = arena_suite_create ();
+  SRunner *runner = srunner_create (suite);
+  srunner_run_all (runner, CK_NORMAL);
+  fail_count = srunner_ntests_failed (runner);
+  srunner_free (runner);
+  free (suite);
+  return fail_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -21,6 +21,7 @@
 #include <time.h>
 #include <check.h>
 #include <errno.h>
+#include <pthread.h>
 #include "class.h"
 #include "malloc.h"
 
@@ -223,6 +224,144 @@ START_TEST (test_fz_instance_of)
 }
 END_TEST
 
+/* Constructor that fails like one running out of memory.  */
+static ptr_t
+failing_constructor (ptr_t ptr, va_list *args)
+{
+  (void) ptr;
+  (void) args;
+  return NULL;
+}
+
+/* Test for `fz_class_reserve' and `fz_class_release'.  */
+START_TEST (test_fz_class_reserve)
+{
+  static const class_t plain_c = {
+    sizeof (test_class_t), NULL, NULL, NULL, NULL, NULL
+  };
+  static const class_t failing_c = {
+    sizeof (test_class_t), failing_constructor, NULL, NULL, NULL, NULL
+  };
+  size_t usage = fz_memusage (0);
+  test_class_t *obj1, *obj2, *obj3;
+
+  ck_assert_int_eq (fz_class_reserve (NULL, 1), -EINVAL);
+  ck_assert_int_eq (fz_class_reserve (&_TEST_, 0), 0);
+  ck_assert_int_eq (fz_class_reserve (&_TEST_, 2), 2);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 2);
+  ck_assert_int_eq (fz_class_pooled (&_TEST2_), 0);
+  ck_assert (fz_memusage (0) > usage);
+
+  /* New instances are taken from the pool until it's empty.  */
+  usage = fz_memusage (0);
+  obj1 = fz_new (&_TEST_, 1, 2, 3);
+  obj2 = fz_new (&_TEST_, 4, 5, 6);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 0);
+  ck_assert (fz_memusage (0) < usage + 2 * sizeof (test_class_t));
+  ck_assert (obj1->a == 1 && obj1->b == 2 && *obj1->c == 3);
+  ck_assert (obj2->a == 4 && obj2->b == 5 && *obj2->c == 6);
+  obj3 = fz_new (&_TEST_, 7, 8, 9);
+  ck_assert (fz_instance_of (obj3, &_TEST_) == TRUE);
+
+  /* Deleted instances are destructed and returned to the pool while
+     it has room.  */
+  (void) fz_retain (obj1);
+  ck_assert_int_eq (fz_del (obj1), 1);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 0);
+  test_destuctor_called = 0;
+  ck_assert_int_eq (fz_del (obj1), 0);
+  ck_assert (test_destuctor_called == 1);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 1);
+  ck_assert_int_eq (fz_del (obj2), 0);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 2);
+  ck_assert_int_eq (fz_del (obj3), 0);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 2);
+  ck_assert_int_eq (fz_memusage (0), usage);
+
+  /* Reused blocks are constructed anew.  */
+  obj1 = fz_new (&_TEST_, 10, 11, 12);
+  ck_assert (obj1 == obj2);
+  ck_assert (obj1->a == 10 && obj1->b == 11 && *obj1->c == 12);
+  ck_assert_int_eq (fz_del (obj1), 0);
+
+  /* Reused blocks are zeroed like fresh ones.  */
+  ck_assert_int_eq (fz_class_reserve (&plain_c, 1), 1);
+  obj1 = fz_new (&plain_c);
+  obj1->a = obj1->b = 1;
+  ck_assert_int_eq (fz_del (obj1), 0);
+  obj1 = fz_new (&plain_c);
+  ck_assert (obj1->a == 0 && obj1->b == 0 && obj1->c == NULL);
+  ck_assert_int_eq (fz_del (obj1), 0);
+  ck_assert_int_eq (fz_class_release (&plain_c, 1), 0);
+
+  /* Blocks of failed constructions go back to the pool.  */
+  ck_assert_int_eq (fz_class_reserve (&failing_c, 1), 1);
+  ck_assert (fz_new (&failing_c) == NULL);
+  ck_assert_int_eq (fz_class_pooled (&failing_c), 1);
+  ck_assert_int_eq (fz_class_release (&failing_c, 1), 0);
+
+  /* Reservations add up and are given back one by one.  */
+  ck_assert_int_eq (fz_class_reserve (&_TEST_, 1), 3);
+  ck_assert_int_eq (fz_class_release (&_TEST_, 4), -EINVAL);
+  ck_assert_int_eq (fz_class_release (&_TEST_, 2), 1);
+  ck_assert (fz_memusage (0) < usage);
+  ck_assert_int_eq (fz_class_release (&_TEST_, 1), 0);
+  ck_assert_int_eq (fz_class_pooled (&_TEST_), 0);
+  ck_assert_int_eq (fz_class_release (&_TEST_, 1), -EINVAL);
+  ck_assert_int_eq (fz_class_release (&_TEST_, 0), 0);
+}
+END_TEST
+
+/* Class without constructor or destructor for concurrency tests.  */
+static const class_t churn_c = {
+  sizeof (test_class_t), NULL, NULL, NULL, NULL, NULL
+};
+
+/* Create and delete pooled objects until *DONE is set.  */
+static void *
+test_churn (void *done)
+{
+  ptr_t objs[4];
+  uint_t i;
+
+  while (!__atomic_load_n ((bool_t *) done, __ATOMIC_ACQUIRE))
+    {
+      for (i = 0; i < 4; ++i)
+        objs[i] = fz_new (&churn_c);
+      for (i = 0; i < 4; ++i)
+        if (objs[i] != NULL)
+          {
+            fz_set_shared (objs[i], TRUE);
+            fz_del (objs[i]);
+          }
+    }
+  return NULL;
+}
+
+/* Test that pools may be reserved and released while other threads
+   create and delete instances.  */
+START_TEST (test_fz_class_reserve_concurrent)
+{
+  pthread_t threads[2];
+  bool_t done = FALSE;
+  size_t usage = fz_memusage (0);
+  uint_t i;
+
+  for (i = 0; i < 2; ++i)
+    ck_assert (pthread_create (&threads[i], NULL, test_churn, &done) == 0);
+  for (i = 0; i < 500; ++i)
+    {
+      ck_assert (fz_class_reserve (&churn_c, 2) >= 0);
+      ck_assert (fz_class_release (&churn_c, 2) >= 0);
+    }
+  __atomic_store_n (&done, TRUE, __ATOMIC_RELEASE);
+  for (i = 0; i < 2; ++i)
+    pthread_join (threads[i], NULL);
+  ck_assert_int_eq (fz_class_pooled (&churn_c), 0);
+  ck_assert_int_eq (fz_memusage (0), usage);
+}
+END_TEST
+
 /* Initiate a class test suite struct.  */
 Suite *
 class_suite_create ()
@@ -236,6 +375,8 @@ class_suite_create ()
   tcase_add_test (t, test_fz_clone);
   tcase_add_test (t, test_fz_cmp);
   tcase_add_test (t, test_fz_instance_of);
+  tcase_add_test (t, test_fz_class_reserve);
+  tcase_add_test (t, test_fz_class_reserve_concurrent);
   suite_add_tcase (s, t);
   return s;
 }
@@ -21,6 +21,7 @@
 #include <time.h>
 #include <stdio.h>
 #include <errno.h>
+#include <math.h>
 #include "delay.h"
 #include "node.h"
 #include "list.h"
@@ -143,6 +144,49 @@ START_TEST (test_delay_output)
 }
 END_TEST
 
+/* Test that the delay line of a voice is silenced when it's stolen.  */
+START_TEST (test_delay_reset)
+{
+  delay_t *delay = fz_new (delay_c);
+  vpool_t *pool = fz_new (vpool_c, (size_t) 1);
+  list_t *frames = fz_new_simple_vector (real_t);
+  size_t nframes = 1000;
+  voice_t *voice;
+  real_t sum;
+  uint_t i;
+
+  fz_delay_set_gain (delay, 0.5);
+  fz_delay_set_feedback (delay, 0.75);
+  fz_delay_set_delay (delay, 100 / fz_get_sample_rate ());
+
+  fz_vpool_press (pool, 60, 1);
+  voice = fz_ref_at (fz_vpool_voices (pool), 0, voice_t);
+  fz_clear (frames, nframes);
+  fz_val_at (frames, 0, real_t) = 1.0;
+  ck_assert (fz_node_render ((node_t *) delay, frames, voice) == nframes);
+
+  /* The delay keeps ringing while the voice plays the same note.  */
+  fz_clear (frames, nframes);
+  fz_node_render ((node_t *) delay, frames, voice);
+  for (i = 0, sum = 0; i < nframes; ++i)
+    sum += fabs (fz_val_at (frames, i, real_t));
+  ck_assert (sum > 0);
+
+  /* Steal the voice for another note.  */
+  fz_vpool_press (pool, 62, 1);
+  ck_assert (fz_ref_at (fz_vpool_voices (pool), 0, voice_t) == voice);
+  fz_clear (frames, nframes);
+  fz_node_render ((node_t *) delay, frames, voice);
+  for (i = 0, sum = 0; i < nframes; ++i)
+    sum += fabs (fz_val_at (frames, i, real_t));
+  ck_assert (sum == 0);
+
+  fz_del (frames);
+  fz_del (pool);
+  fz_del (delay);
+}
+END_TEST
+
 /* Initiate a delay test suite struct.  */
 Suite *
 delay_suite_create ()
@@ -152,6 +196,7 @@ delay_suite_create ()
   tcase_add_checked_fixture (t, setup, teardown);
   tcase_add_test (t, test_delay_setget);
   tcase_add_test (t, test_delay_output);
+  tcase_add_test (t, test_delay_reset);
   suite_add_tcase (s, t);
   return s;
 }
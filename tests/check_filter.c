@@ -19,6 +19,7 @@
 
 #include <check.h>
 #include <stdio.h>
+#include "malloc.h"
 #include "filter.h"
 #include "node.h"
 #include "form.h"
@@ -111,6 +112,26 @@ START_TEST (test_filter)
 }
 END_TEST
 
+/* Test that running out of memory for voice states is reported.  */
+START_TEST (test_filter_nomem)
+{
+  filter_t *filter = fz_new (filter_c);
+  voice_t *voice = fz_new (voice_c);
+  list_t *frames = fz_new_simple_vector (real_t);
+  fz_clear (frames, 64);
+
+  ck_assert (fz_set_membudget (fz_memusage (0)) == 0);
+  ck_assert_int_eq (fz_node_render ((node_t *) filter, frames, voice),
+                    -ENOMEM);
+  ck_assert (fz_set_membudget (0) == 0);
+  ck_assert_int_eq (fz_node_render ((node_t *) filter, frames, voice), 64);
+
+  fz_del (frames);
+  fz_del (voice);
+  fz_del (filter);
+}
+END_TEST
+
 /* Initiate a filter test suite struct.  */
 Suite *
 filter_suite_create ()
@@ -119,6 +140,7 @@ filter_suite_create ()
   TCase *t = tcase_create ("filter");
   tcase_add_checked_fixture (t, setup, teardown);
   tcase_add_test (t, test_filter);
+  tcase_add_test (t, test_filter_nomem);
   suite_add_tcase (s, t);
   return s;
 }
@@ -95,6 +95,43 @@ START_TEST (test_form_shapes)
 }
 END_TEST
 
+/* Test rendering a block in two parts through a view.  */
+START_TEST (test_form_render_view)
+{
+  form_t *whole = fz_new (form_c, SHAPE_SINE);
+  form_t *split = fz_new (form_c, SHAPE_SINE);
+  voice_t *voice = fz_new (voice_c);
+  list_t *expected = fz_new_simple_vector (real_t);
+  list_t *frames = fz_new_simple_vector (real_t);
+  list_t *view = fz_new_view (real_t);
+  size_t nframes = 256;
+  uint_t i;
+
+  fz_voice_press (voice, 440, 1);
+  fz_clear (expected, nframes);
+  fz_clear (frames, nframes);
+  ck_assert (fz_node_render ((node_t *) whole, expected, voice)
+             == (int_t) nframes);
+
+  /* The view renders into FRAMES without a temporary buffer.  */
+  ck_assert (fz_view_slice (view, frames, 0, 100) == 100);
+  ck_assert (fz_node_render ((node_t *) split, view, voice) == 100);
+  ck_assert (fz_view_slice (view, frames, 100, nframes - 100) > 0);
+  ck_assert (fz_node_render ((node_t *) split, view, voice)
+             == (int_t) nframes - 100);
+  for (i = 0; i < nframes; ++i)
+    ck_assert (fz_val_at (frames, i, real_t)
+               == fz_val_at (expected, i, real_t));
+
+  fz_del (view);
+  fz_del (frames);
+  fz_del (expected);
+  fz_del (voice);
+  fz_del (split);
+  fz_del (whole);
+}
+END_TEST
+
 /* Initiate a form test suite struct.  */
 Suite *
 form_suite_create ()
@@ -103,6 +140,7 @@ form_suite_create ()
   TCase *t = tcase_create ("form");
   tcase_add_checked_fixture (t, setup, teardown);
   tcase_add_test (t, test_form_shapes);
+  tcase_add_test (t, test_form_render_view);
   suite_add_tcase (s, t);
   return s;
 }
@@ -22,6 +22,8 @@
 #include "graph.h"
 #include "private-node.h"
 #include "private-mod.h"
+#include "delay.h"
+#include "adsr.h"
 
 #define TEST_NODE_SLOT 0
 
@@ -316,6 +318,97 @@ START_TEST (test_fz_graph_render)
 }
 END_TEST
 
+/* `memtrace_f' counting backend operations made in render scope.  */
+static void
+test_memtrace (const memtrace_t *record, ptr_t data)
+{
+  if (record->rt && record->op != MEMTRACE_RESIZE
+      && record->op != MEMTRACE_UNREF)
+    ++*(int_t *) data;
+}
+
+/* Test that `fz_graph_prepare' and `fz_graph_render' enter a render
+   scope.  */
+START_TEST (test_fz_graph_rt_scope)
+{
+  int_t nframes = 64;
+  int_t count = 0;
+  node_t *in = fz_new (test_node_c, (real_t) 1);
+  node_t *out = fz_new (node_c);
+
+  fz_graph_add_node (test_graph, in);
+  fz_graph_add_node (test_graph, out);
+  fz_graph_connect (test_graph, in, out);
+
+  /* Buffers are grown on the first prepare.  */
+  fz_set_memtrace (test_memtrace, &count);
+  ck_assert (fz_graph_prepare (test_graph, nframes) == 0);
+  ck_assert_int_eq (fz_graph_render (test_graph, NULL), nframes);
+  ck_assert (fz_rt_active () == FALSE);
+  ck_assert (count > 0);
+
+  /* Once warmed up nothing should be allocated.  */
+  count = 0;
+  ck_assert (fz_graph_prepare (test_graph, nframes) == 0);
+  ck_assert_int_eq (fz_graph_render (test_graph, NULL), nframes);
+  fz_set_memtrace (NULL, NULL);
+  ck_assert_int_eq (count, 0);
+
+  fz_del (out);
+  fz_del (in);
+}
+END_TEST
+
+/* Test for `fz_graph_reserve'.  */
+START_TEST (test_fz_graph_reserve)
+{
+  int_t nframes = 256;
+  int_t count = 0;
+  uint_t i;
+  vpool_t *pool = fz_new (vpool_c, (size_t) 4);
+  const list_t *voices = fz_vpool_all_voices (pool);
+  node_t *in = fz_new (test_node_c, (real_t) 1);
+  delay_t *delay = fz_new (delay_c);
+  mod_t *env = fz_new (adsr_c);
+
+  fz_delay_set_delay (delay, .1);
+  fz_node_connect ((node_t *) delay, env, TEST_NODE_SLOT, NULL);
+  fz_graph_add_node (test_graph, in);
+  fz_graph_add_node (test_graph, (node_t *) delay);
+  fz_graph_connect (test_graph, in, (node_t *) delay);
+
+  /* Voices are reserved for whether they are pressed or not.  */
+  ck_assert_int_eq (fz_vpool_press (pool, A4_ID, 1), 0);
+  ck_assert_int_eq (fz_len ((const ptr_t) voices), 4);
+
+  ck_assert (fz_graph_reserve (NULL, voices, nframes, FALSE) == -EINVAL);
+  ck_assert (fz_graph_reserve (test_graph, voices, nframes, FALSE) == 0);
+  ck_assert (fz_capacity (fz_graph_buffer (test_graph, in))
+             >= (size_t) nframes);
+
+  /* Rendering with any of the voices allocates nothing.  */
+  fz_set_memtrace (test_memtrace, &count);
+  for (i = 0; i < fz_len ((const ptr_t) voices); ++i)
+    {
+      voice_t *voice = fz_ref_at (voices, i, voice_t);
+      fz_voice_press (voice, 440, 1);
+      ck_assert (fz_graph_prepare (test_graph, nframes) == 0);
+      ck_assert_int_eq (fz_graph_render (test_graph, voice), nframes);
+    }
+  fz_set_memtrace (NULL, NULL);
+  ck_assert_int_eq (count, 0);
+
+  /* Locking may not be permitted here but should not break anything.  */
+  int_t err = fz_graph_reserve (test_graph, voices, nframes, TRUE);
+  ck_assert (err == 0 || err == -ENOMEM || err == -EPERM || err == -EAGAIN);
+
+  fz_del (env);
+  fz_del (delay);
+  fz_del (in);
+  fz_del (pool);
+}
+END_TEST
+
 /* Initiate a graph test suite struct.  */
 Suite *
 graph_suite_create ()
@@ -326,6 +419,8 @@ graph_suite_create ()
   tcase_add_test (t, test_fz_graph_add_node);
   tcase_add_test (t, test_fz_graph_connect);
   tcase_add_test (t, test_fz_graph_render);
+  tcase_add_test (t, test_fz_graph_rt_scope);
+  tcase_add_test (t, test_fz_graph_reserve);
   suite_add_tcase (s, t);
   return s;
 }
@@ -18,11 +18,13 @@
    <http://www.gnu.org/licenses/>.  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <check.h>
 #include <errno.h>
 #include "malloc.h"
 #include "list.h"
+#include "private-list.h"
 
 /* `vector_c' instance instantiated in `setup'.  */
 list_t *test_vector = NULL;
@@ -149,6 +151,354 @@ START_TEST (test_fz_clear)
 }
 END_TEST
 
+/* Test for `fz_reserve' and `fz_capacity'.  */
+START_TEST (test_fz_reserve)
+{
+  int_t item = 7;
+  ptr_t data;
+  uint_t i;
+
+  ck_assert (fz_reserve (NULL, 10) == -EINVAL);
+  ck_assert (fz_capacity (NULL) == 0);
+  ck_assert (fz_capacity (test_vector) == 0);
+  ck_assert (fz_reserve (test_vector, 10) == 10);
+  ck_assert (fz_capacity (test_vector) == 10);
+  ck_assert (fz_len (test_vector) == 0);
+
+  /* Reserving less never shrinks.  */
+  ck_assert (fz_reserve (test_vector, 5) == 10);
+
+  /* Items fit without moving the data.  */
+  fz_push_one (test_vector, &item);
+  data = fz_list_data (test_vector);
+  for (i = 1; i < 10; ++i)
+    fz_push_one (test_vector, &item);
+  ck_assert (fz_list_data (test_vector) == data);
+  ck_assert (fz_capacity (test_vector) == 10);
+
+  /* Growing beyond capacity at least doubles it.  */
+  fz_push_one (test_vector, &item);
+  ck_assert (fz_capacity (test_vector) >= 20);
+  ck_assert (fz_val_at (test_vector, 0, int_t) == item);
+  ck_assert (fz_val_at (test_vector, 10, int_t) == item);
+
+  /* Clearing keeps capacity.  */
+  ck_assert (fz_clear (test_vector, 0) == 0);
+  ck_assert (fz_capacity (test_vector) >= 20);
+}
+END_TEST
+
+/* Test for `fz_shrink_to_fit'.  */
+START_TEST (test_fz_shrink_to_fit)
+{
+  int_t item = 3;
+
+  ck_assert (fz_shrink_to_fit (NULL) == -EINVAL);
+  ck_assert (fz_reserve (test_vector, 100) == 100);
+  ck_assert (fz_shrink_to_fit (test_vector) == 0);
+  ck_assert (fz_capacity (test_vector) == 0);
+  ck_assert (fz_list_data (test_vector) == NULL);
+
+  ck_assert (fz_reserve (test_vector, 100) == 100);
+  fz_push_one (test_vector, &item);
+  fz_push_one (test_vector, &item);
+  ck_assert (fz_shrink_to_fit (test_vector) == 0);
+  ck_assert (fz_capacity (test_vector) == 2);
+  ck_assert (fz_len (test_vector) == 2);
+  ck_assert (fz_val_at (test_vector, 1, int_t) == item);
+}
+END_TEST
+
+/* Test for `LISTOPT_ALIGN'.  */
+START_TEST (test_listopt_align)
+{
+  list_t *vector = fz_new_aligned_vector (real_t);
+  real_t sample = 1;
+  uint_t i;
+
+  for (i = 0; i < 1000; ++i)
+    {
+      fz_push_one (vector, &sample);
+      ck_assert ((size_t) fz_list_data (vector) % MEMALIGN_SIMD == 0);
+    }
+
+  fz_erase (vector, 0, 999);
+  ck_assert (fz_shrink_to_fit (vector) == 0);
+  ck_assert ((size_t) fz_list_data (vector) % MEMALIGN_SIMD == 0);
+  ck_assert (fz_val_at (vector, 0, real_t) == sample);
+  fz_del (vector);
+}
+END_TEST
+
+/* Test that failed allocations are reported by `fz_insert'.  */
+START_TEST (test_fz_insert_nomem)
+{
+  int_t item = 1;
+  fz_push_one (test_vector, &item);
+  ck_assert (fz_set_membudget (fz_memusage (0) + 100) == 0);
+  ck_assert (fz_push (test_vector, 1000, NULL) == -ENOMEM);
+  ck_assert (fz_len (test_vector) == 1);
+  ck_assert (fz_reserve (test_vector, 1000) == -ENOMEM);
+  ck_assert (fz_clear (test_vector, 1000) == -ENOMEM);
+  ck_assert (fz_set_membudget (0) == 0);
+}
+END_TEST
+
+/* Test for `fz_resize'.  */
+START_TEST (test_fz_resize)
+{
+  int_t items[] = {1, 2, 3};
+  fz_push (test_vector, 3, items);
+  ck_assert (fz_resize (test_vector, 2) == 2);
+  ck_assert (fz_len (test_vector) == 2);
+  ck_assert (fz_val_at (test_vector, 1, int_t) == 2);
+  ck_assert (fz_resize (test_vector, 4) == 4);
+  ck_assert (fz_val_at (test_vector, 0, int_t) == 1);
+  ck_assert (fz_val_at (test_vector, 1, int_t) == 2);
+  ck_assert (fz_val_at (test_vector, 2, int_t) == 0);
+  ck_assert (fz_val_at (test_vector, 3, int_t) == 0);
+  ck_assert (fz_resize (NULL, 1) == -EINVAL);
+}
+END_TEST
+
+/* Test for `fz_zero'.  */
+START_TEST (test_fz_zero)
+{
+  int_t items[] = {1, 2, 3};
+  fz_push (test_vector, 3, items);
+  ck_assert (fz_zero (test_vector) == 3);
+  ck_assert (fz_len (test_vector) == 3);
+  ck_assert (fz_val_at (test_vector, 0, int_t) == 0);
+  ck_assert (fz_val_at (test_vector, 2, int_t) == 0);
+
+  list_t *list = fz_new_owning_vector (list_t *);
+  ck_assert (fz_zero (list) == -EINVAL);
+  ck_assert (fz_zero (NULL) == -EINVAL);
+  ck_assert (fz_del (list) == 0);
+}
+END_TEST
+
+/* Test for the inline vector accessors.  */
+START_TEST (test_fz_vector_at)
+{
+  int_t items[] = {1, 2, 3};
+  fz_push (test_vector, 3, items);
+  ck_assert (fz_is_vector (test_vector));
+  ck_assert (fz_vector_len (test_vector) == 3);
+  ck_assert (fz_vector_val_at (test_vector, 1, int_t) == 2);
+  ck_assert (fz_vector_ref_at (test_vector, 2, int_t)
+             == fz_ref_at (test_vector, 2, int_t));
+  ck_assert (fz_vector_data (test_vector, int_t)
+             == fz_list_data (test_vector));
+
+  list_t *list = fz_new_owning_vector (list_t *);
+  ck_assert (fz_is_vector (list));
+  ck_assert (!fz_is_vector (NULL));
+  fz_push_one (list, fz_new_simple_vector (int_t));
+  ck_assert (fz_vector_ptr_at (list, 0, list_t)
+             == fz_ref_at (list, 0, list_t));
+  ck_assert (fz_del (list) == 0);
+}
+END_TEST
+
+FZ_VECTOR_DEFINE (int_vector, int_t)
+FZ_VECTOR_DEFINE (list_vector, list_t *)
+
+/* Test for functions defined by `FZ_VECTOR_DEFINE'.  */
+START_TEST (test_vector_define)
+{
+  int_t items[] = {1, 2, 3};
+  fz_push (test_vector, 3, items);
+  ck_assert_int_eq (int_vector_len (test_vector), 3);
+  ck_assert (int_vector_data (test_vector) == fz_list_data (test_vector));
+  ck_assert_int_eq (int_vector_at (test_vector, 1), 2);
+  *int_vector_ref (test_vector, 2) = 4;
+  ck_assert_int_eq (fz_val_at (test_vector, 2, int_t), 4);
+
+  list_t *small = fz_new_small_vector (int_t, LISTOPT_NONE);
+  fz_push (small, 3, items);
+  ck_assert_int_eq (int_vector_at (small, 2), 3);
+
+  list_t *list = fz_new_owning_vector (list_t *);
+  fz_push_one (list, small);
+  ck_assert_int_eq (list_vector_len (list), 1);
+  ck_assert (list_vector_at (list, 0) == small);
+  ck_assert (list_vector_data (list)[0] == fz_ref_at (list, 0, list_t));
+  ck_assert (fz_del (list) == 0);
+}
+END_TEST
+
+/* Test for `ringbuf_c' insert, erase and indexing.  */
+START_TEST (test_ringbuf)
+{
+  int_t i;
+  int_t items[] = {1, 2, 3, 4, 5};
+  list_t *ring = fz_new_ringbuf (int_t, LISTOPT_NONE);
+  ck_assert (fz_reserve (ring, 5) == 8);
+  ck_assert (fz_capacity (ring) == 8);
+
+  /* Push and pop around the end of the block so that items wrap.  */
+  for (i = 0; i < 6; ++i)
+    {
+      ck_assert (fz_push (ring, 5, items) >= 0);
+      ck_assert (fz_erase (ring, 0, 5) == 0);
+    }
+  ck_assert (fz_push (ring, 5, items) >= 0);
+  ck_assert (fz_capacity (ring) == 8);
+  for (i = 0; i < 5; ++i)
+    ck_assert (fz_val_at (ring, i, int_t) == items[i]);
+
+  /* Insert at the front, in the middle and erase from the middle.  */
+  ck_assert (fz_insert (ring, 0, 1, &items[4]) == 0);
+  ck_assert (fz_insert (ring, 3, 1, &items[0]) == 3);
+  ck_assert (fz_len (ring) == 7);
+  ck_assert (fz_val_at (ring, 0, int_t) == 5);
+  ck_assert (fz_val_at (ring, 1, int_t) == 1);
+  ck_assert (fz_val_at (ring, 3, int_t) == 1);
+  ck_assert (fz_val_at (ring, 4, int_t) == 3);
+  ck_assert (fz_erase (ring, 3, 2) == 3);
+  ck_assert (fz_val_at (ring, 3, int_t) == 4);
+  ck_assert (fz_val_at (ring, 4, int_t) == 5);
+
+  /* Growing beyond capacity keeps the order.  */
+  ck_assert (fz_push (ring, 5, items) >= 0);
+  ck_assert (fz_capacity (ring) == 16);
+  ck_assert (fz_val_at (ring, 0, int_t) == 5);
+  ck_assert (fz_val_at (ring, 9, int_t) == 5);
+
+  ck_assert (fz_sort (ring, fz_cmp_int) == 0);
+  for (i = 1; (size_t) i < fz_len (ring); ++i)
+    ck_assert (fz_val_at (ring, i - 1, int_t)
+               <= fz_val_at (ring, i, int_t));
+
+  ck_assert (fz_shrink_to_fit (ring) == 0);
+  ck_assert (fz_capacity (ring) == 16);
+  ck_assert (fz_erase (ring, 0, 4) == 0);
+  ck_assert (fz_shrink_to_fit (ring) == 0);
+  ck_assert (fz_capacity (ring) == 8);
+  ck_assert (fz_del (ring) == 0);
+}
+END_TEST
+
+/* Test for `fz_ringbuf_read', `fz_ringbuf_write' and
+   `fz_ringbuf_span'.  */
+START_TEST (test_ringbuf_span)
+{
+  int_t in[] = {1, 2, 3, 4, 5, 6};
+  int_t out[6] = {0};
+  size_t num;
+  int_t *span;
+  list_t *ring = fz_new_ringbuf (int_t, LISTOPT_NONE);
+  ck_assert (fz_resize (ring, 8) == 8);
+  ck_assert (fz_erase (ring, 0, 5) == 0);
+  ck_assert (fz_push (ring, 5, NULL) >= 0);
+
+  /* Items 0-2 are at the end of the block and 3-7 at the start.  */
+  span = fz_ringbuf_span (ring, 1, &num);
+  ck_assert (span != NULL && num == 2);
+  span = fz_ringbuf_span (ring, 3, &num);
+  ck_assert (span != NULL && num == 5);
+  ck_assert (fz_ringbuf_span (ring, 8, &num) == NULL);
+
+  ck_assert (fz_ringbuf_write (ring, 1, 6, in) == 6);
+  ck_assert (fz_val_at (ring, 2, int_t) == 2);
+  ck_assert (fz_val_at (ring, 3, int_t) == 3);
+  ck_assert (fz_ringbuf_read (ring, 1, 6, out) == 6);
+  ck_assert (memcmp (in, out, sizeof (in)) == 0);
+  ck_assert (fz_ringbuf_write (ring, 3, 6, in) == -EINVAL);
+  ck_assert (fz_ringbuf_read (test_vector, 0, 0, out) == -EINVAL);
+  ck_assert (fz_del (ring) == 0);
+}
+END_TEST
+
+/* Predicate for odd numbers.  */
+static bool_t
+is_odd (const ptr_t item, ptr_t data)
+{
+  (void) data;
+  return *((int_t *) item) % 2 ? TRUE : FALSE;
+}
+
+/* Predicate for the list DATA.  */
+static bool_t
+is_list (const ptr_t item, ptr_t data)
+{
+  return item == data ? TRUE : FALSE;
+}
+
+/* Test for `fz_erase_if'.  */
+START_TEST (test_fz_erase_if)
+{
+  int_t items[] = {1, 2, 3, 4, 5, 6, 8};
+  fz_push (test_vector, 7, items);
+  ck_assert (fz_erase_if (test_vector, is_odd, NULL) == 3);
+  ck_assert (fz_len (test_vector) == 4);
+  ck_assert (fz_val_at (test_vector, 0, int_t) == 2);
+  ck_assert (fz_val_at (test_vector, 3, int_t) == 8);
+  ck_assert (fz_erase_if (test_vector, is_odd, NULL) == 0);
+  ck_assert (fz_erase_if (test_vector, NULL, NULL) == -EINVAL);
+
+  /* Ring buffers and owned items.  */
+  list_t *ring = fz_new_ringbuf (int_t, LISTOPT_NONE);
+  fz_push (ring, 7, items);
+  ck_assert (fz_erase_if (ring, is_odd, NULL) == 3);
+  ck_assert (fz_val_at (ring, 1, int_t) == 4);
+  ck_assert (fz_del (ring) == 0);
+
+  list_t *owner = fz_new_owning_vector (list_t *);
+  list_t *item = fz_new_simple_vector (int_t);
+  fz_push_one (owner, fz_new_simple_vector (int_t));
+  fz_push_one (owner, item);
+  size_t usage = fz_memusage (0);
+  ck_assert (fz_erase_if (owner, is_list, item) == 1);
+  ck_assert (fz_len (owner) == 1);
+  ck_assert (fz_memusage (0) < usage);
+  ck_assert (fz_del (owner) == 0);
+}
+END_TEST
+
+/* Test for `fz_partition'.  */
+START_TEST (test_fz_partition)
+{
+  int_t i;
+  int_t items[] = {1, 2, 3, 4, 5, 6, 8};
+  fz_push (test_vector, 7, items);
+  ck_assert (fz_partition (test_vector, is_odd, NULL) == 4);
+  ck_assert (fz_len (test_vector) == 7);
+  ck_assert (fz_val_at (test_vector, 0, int_t) == 2);
+  ck_assert (fz_val_at (test_vector, 1, int_t) == 4);
+  ck_assert (fz_val_at (test_vector, 2, int_t) == 6);
+  ck_assert (fz_val_at (test_vector, 3, int_t) == 8);
+  for (i = 4; i < 7; ++i)
+    ck_assert (is_odd (fz_at (test_vector, i), NULL));
+  ck_assert (fz_partition (NULL, is_odd, NULL) == -EINVAL);
+}
+END_TEST
+
+/* Test for `fz_transfer'.  */
+START_TEST (test_fz_transfer)
+{
+  list_t *src = fz_new_owning_vector (list_t *);
+  list_t *dst = fz_new_vector (list_t *, LISTOPT_PASS | LISTOPT_INDEX);
+  list_t *a = fz_new_simple_vector (int_t);
+  list_t *b = fz_new_simple_vector (int_t);
+  fz_push_one (src, a);
+  fz_push_one (src, b);
+  fz_push_one (dst, fz_new_simple_vector (int_t));
+
+  ck_assert (fz_transfer (dst, src, 0, 2) == 1);
+  ck_assert (fz_len (src) == 0);
+  ck_assert (fz_len (dst) == 3);
+  ck_assert (fz_refcount (a) == 1);
+  ck_assert (fz_index_of (dst, b, fz_cmp_ptr) == 2);
+  ck_assert (fz_transfer (dst, test_vector, 0, 0) == -EINVAL);
+  ck_assert (fz_transfer (dst, src, 0, 1) == -EINVAL);
+
+  ck_assert (fz_del (src) == 0);
+  ck_assert (fz_del (dst) == 0);
+}
+END_TEST
+
 /* Test for `fz_index_of'.  */
 START_TEST (test_fz_index_of)
 {
@@ -200,6 +550,120 @@ START_TEST (test_fz_index_of)
 }
 END_TEST
 
+/* Test for `fz_index_of' with LISTOPT_INDEX.  */
+START_TEST (test_listopt_index)
+{
+  int_t i;
+  int_t items[64];
+  list_t *list = fz_new_vector (int_t *, LISTOPT_INDEX);
+  for (i = 0; i < 64; ++i)
+    ck_assert (fz_push_one (list, &items[i]) == i);
+  for (i = 0; i < 64; ++i)
+    ck_assert (fz_index_of (list, &items[i], fz_cmp_ptr) == i);
+  ck_assert (fz_index_of (list, &i, fz_cmp_ptr) == -1);
+
+  /* Items move after erase and insert.  */
+  ck_assert (fz_erase (list, 10, 5) == 10);
+  ck_assert (fz_index_of (list, &items[12], NULL) == -1);
+  ck_assert (fz_index_of (list, &items[15], NULL) == 10);
+  ck_assert (fz_insert (list, 0, 1, &items[63]) == 0);
+  ck_assert (fz_index_of (list, &items[63], NULL) == 0);
+  ck_assert (fz_index_of (list, &items[0], NULL) == 1);
+
+  /* The first position of a pointer is found.  */
+  ck_assert (fz_push_one (list, &items[0]) >= 0);
+  ck_assert (fz_index_of (list, &items[0], NULL) == 1);
+  ck_assert (fz_shrink_to_fit (list) == 0);
+  ck_assert (fz_index_of (list, &items[20], NULL) == 16);
+
+  /* Sorting updates the index before any lookup.  */
+  ck_assert (fz_sort (list, fz_cmp_ptr) == 0);
+  for (i = 0; (size_t) i < fz_len (list); ++i)
+    {
+      ptr_t item = fz_at (list, i);
+      int_t pos = fz_index_of (list, item, NULL);
+      ck_assert (pos >= 0 && pos <= i);
+      ck_assert (fz_at (list, pos) == item);
+    }
+  ck_assert (fz_del (list) == 0);
+}
+END_TEST
+
+/* Test for `small_vector_c'.  */
+START_TEST (test_small_vector)
+{
+  int_t i;
+  real_t item;
+  list_t *list = fz_new_small_vector (real_t, LISTOPT_NONE);
+  size_t ninline = VECTOR_INLINE_SIZE / sizeof (real_t);
+  ck_assert (fz_is_vector (list));
+  ck_assert (fz_capacity (list) == ninline);
+
+  /* Inline items don't need a separate block.  */
+  size_t usage = fz_memusage (0);
+  for (i = 0; (size_t) i < ninline; ++i)
+    {
+      item = i;
+      ck_assert (fz_push_one (list, &item) == i);
+    }
+  ck_assert (fz_memusage (0) == usage);
+  ck_assert (fz_list_data (list) == fz_vector_data (list, real_t));
+
+  /* Spill to the heap and move back inline.  */
+  item = ninline;
+  ck_assert (fz_push_one (list, &item) == (int_t) ninline);
+  ck_assert (fz_capacity (list) > ninline);
+  ck_assert (fz_memusage (0) > usage);
+  for (i = 0; (size_t) i <= ninline; ++i)
+    ck_assert (fz_val_at (list, i, real_t) == i);
+  ck_assert (fz_erase (list, 0, 2) == 0);
+  ck_assert (fz_shrink_to_fit (list) == 0);
+  ck_assert (fz_capacity (list) == ninline);
+  ck_assert (fz_memusage (0) == usage);
+  ck_assert (fz_val_at (list, 0, real_t) == 2);
+  ck_assert (fz_del (list) == 0);
+
+  /* Aligned small vectors have no inline storage.  */
+  list = fz_new_small_vector (real_t, LISTOPT_ALIGN);
+  ck_assert (fz_capacity (list) == 0);
+  ck_assert (fz_del (list) == 0);
+}
+END_TEST
+
+/* Test for LISTOPT_VIEW, `fz_view_set' and `fz_view_slice'.  */
+START_TEST (test_listopt_view)
+{
+  real_t items[] = {1, 2, 3, 4};
+  list_t *view = fz_new_view (real_t);
+  size_t usage = fz_memusage (0);
+  ck_assert (fz_len (view) == 0);
+  ck_assert (fz_view_set (view, items, 4) == 4);
+  ck_assert (fz_memusage (0) == usage);
+  ck_assert (fz_list_data (view) == items);
+  ck_assert (fz_val_at (view, 3, real_t) == 4);
+
+  /* Writes go to the viewed items but the view can't grow.  */
+  fz_val_at (view, 0, real_t) = 5;
+  ck_assert (items[0] == 5);
+  ck_assert (fz_push_one (view, &items[0]) == -ENOSPC);
+  ck_assert (fz_resize (view, 2) == 2);
+  ck_assert (fz_zero (view) == 2);
+  ck_assert (items[1] == 0 && items[2] == 3);
+
+  /* Slices of another vector.  */
+  list_t *list = fz_new_simple_vector (real_t);
+  fz_push (list, 4, items);
+  ck_assert (fz_view_slice (view, list, 1, 3) == 3);
+  ck_assert (fz_vector_data (view, real_t)
+             == fz_vector_data (list, real_t) + 1);
+  ck_assert (fz_view_slice (view, list, 2, 3) == -EINVAL);
+  ck_assert (fz_view_slice (view, test_vector, 0, 0) == -EINVAL);
+  ck_assert (fz_view_set (list, items, 4) == -EINVAL);
+  ck_assert (fz_del (list) == 0);
+  ck_assert (fz_del (view) == 0);
+}
+END_TEST
+
 /* Test for `fz_sort'.  */
 START_TEST (test_fz_sort)
 {
@@ -236,6 +700,69 @@ START_TEST (test_fz_sort)
 }
 END_TEST
 
+/* Test `fz_sort' with reals, which are compared without truncation,
+   and with enough items for the quicksort and heapsort paths.  */
+START_TEST (test_fz_sort_real)
+{
+  list_t *list = fz_new_simple_vector (real_t);
+  real_t small[] = {0.5, 0.25, -0.25, 0.75};
+  real_t val;
+  int_t i;
+
+  ck_assert (fz_cmp_real (&small[0], &small[1]) > 0);
+  ck_assert (fz_cmp_real (&small[2], &small[1]) < 0);
+  ck_assert (fz_cmp_real (&small[0], &small[0]) == 0);
+
+  fz_push (list, 4, small);
+  ck_assert (fz_sort (list, fz_cmp_real) == 0);
+  ck_assert (fz_val_at (list, 0, real_t) == -0.25);
+  ck_assert (fz_val_at (list, 3, real_t) == 0.75);
+
+  /* Random, sorted, reversed and constant input.  */
+  fz_clear (list, 0);
+  srand (time (0));
+  for (i = 0; i < 1000; ++i)
+    {
+      val = (real_t) rand () / RAND_MAX;
+      fz_push_one (list, &val);
+    }
+  for (i = 0; i < 1000; ++i)
+    {
+      val = i % 2 ? 1000 - i : 0.5;
+      fz_push_one (list, &val);
+    }
+  ck_assert (fz_sort (list, fz_cmp_real) == 0);
+  ck_assert (fz_sort (list, fz_cmp_real) == 0);
+  for (i = 1; i < fz_len (list); ++i)
+    ck_assert (fz_val_at (list, i - 1, real_t)
+               <= fz_val_at (list, i, real_t));
+
+  fz_del (list);
+}
+END_TEST
+
+/* Test for `fz_sort_one'.  */
+START_TEST (test_fz_sort_one)
+{
+  int_t items[] = {1, 3, 5, 7, 9};
+  int_t i;
+  fz_push (test_vector, 5, items);
+
+  fz_val_at (test_vector, 0, int_t) = 8;
+  ck_assert (fz_sort_one (test_vector, 0, fz_cmp_int) == 3);
+  fz_val_at (test_vector, 4, int_t) = 0;
+  ck_assert (fz_sort_one (test_vector, 4, fz_cmp_int) == 0);
+  fz_val_at (test_vector, 2, int_t) = 6;
+  ck_assert (fz_sort_one (test_vector, 2, fz_cmp_int) == 2);
+  for (i = 1; i < fz_len (test_vector); ++i)
+    ck_assert (fz_val_at (test_vector, i - 1, int_t)
+               <= fz_val_at (test_vector, i, int_t));
+
+  ck_assert (fz_sort_one (test_vector, 5, fz_cmp_int) == -EINVAL);
+  ck_assert (fz_sort_one (NULL, 0, fz_cmp_int) == -EINVAL);
+}
+END_TEST
+
 /* Test for `list_c' option LISTOPT_PTRS.  */
 START_TEST (test_listopt_ptrs)
 {
@@ -350,8 +877,26 @@ list_suite_create ()
   tcase_add_test (t, test_fz_insert);
   tcase_add_test (t, test_fz_erase);
   tcase_add_test (t, test_fz_clear);
+  tcase_add_test (t, test_fz_reserve);
+  tcase_add_test (t, test_fz_shrink_to_fit);
+  tcase_add_test (t, test_listopt_align);
+  tcase_add_test (t, test_fz_insert_nomem);
+  tcase_add_test (t, test_fz_resize);
+  tcase_add_test (t, test_fz_zero);
+  tcase_add_test (t, test_fz_vector_at);
+  tcase_add_test (t, test_vector_define);
+  tcase_add_test (t, test_ringbuf);
+  tcase_add_test (t, test_ringbuf_span);
+  tcase_add_test (t, test_fz_erase_if);
+  tcase_add_test (t, test_fz_partition);
+  tcase_add_test (t, test_fz_transfer);
   tcase_add_test (t, test_fz_index_of);
+  tcase_add_test (t, test_listopt_index);
+  tcase_add_test (t, test_small_vector);
+  tcase_add_test (t, test_listopt_view);
   tcase_add_test (t, test_fz_sort);
+  tcase_add_test (t, test_fz_sort_real);
+  tcase_add_test (t, test_fz_sort_one);
   tcase_add_test (t, test_listopt_ptrs);
   tcase_add_test (t, test_listopt_keep);
   tcase_add_test (t, test_listopt_pass);
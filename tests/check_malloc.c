@@ -21,6 +21,8 @@
 #include <time.h>
 #include <check.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include "malloc.h"
 
 /* Test variables initiated in `setup'.  */
@@ -126,6 +128,378 @@ START_TEST (test_fz_memusage)
 }
 END_TEST
 
+/* Test for `fz_malloc_aligned'.  */
+START_TEST (test_fz_malloc_aligned)
+{
+  size_t usage = fz_memusage (MEMUSAGE_DISP);
+  size_t align;
+  ptr_t ptr;
+
+  ck_assert (fz_malloc_aligned (10, 0) == NULL);
+  ck_assert (fz_malloc_aligned (10, 48) == NULL);
+  ck_assert (fz_malloc_aligned (10, 8192) == NULL);
+
+  for (align = 1; align <= 4096; align *= 2)
+    {
+      ptr = fz_malloc_aligned (100, align);
+      ck_assert (ptr != NULL);
+      ck_assert ((size_t) ptr % align == 0);
+      ck_assert (fz_memusage (MEMUSAGE_DISP) == usage + 100);
+
+      /* Growing keeps both the alignment and the contents.  */
+      ((char *) ptr)[99] = 42;
+      ptr = fz_realloc (ptr, 10000);
+      ck_assert (ptr != NULL);
+      ck_assert ((size_t) ptr % align == 0);
+      ck_assert (((char *) ptr)[99] == 42);
+      ck_assert (fz_free (ptr) == 0);
+      ck_assert (fz_memusage (MEMUSAGE_DISP) == usage);
+    }
+}
+END_TEST
+
+/* Thread routine for `test_fz_set_shared'.  */
+static void *
+shared_thread (void *arg)
+{
+  int i;
+  for (i = 0; i < 100000; ++i)
+    {
+      fz_retain (arg);
+      fz_free (arg);
+    }
+  return NULL;
+}
+
+/* Test for `fz_set_shared'.  */
+START_TEST (test_fz_set_shared)
+{
+  pthread_t threads[4];
+  int i;
+
+  ck_assert (fz_set_shared (NULL, TRUE) == -EINVAL);
+  ck_assert (fz_is_shared (NULL) == FALSE);
+  ck_assert (fz_set_shared (test_ptr, FALSE) == 0);
+  ck_assert (fz_is_shared (test_ptr) == FALSE);
+  ck_assert (fz_set_shared (test_ptr, TRUE) == 0);
+  ck_assert (fz_is_shared (test_ptr) == TRUE);
+
+  for (i = 0; i < 4; ++i)
+    ck_assert (pthread_create (&threads[i], NULL, shared_thread,
+                               test_ptr) == 0);
+  for (i = 0; i < 4; ++i)
+    ck_assert (pthread_join (threads[i], NULL) == 0);
+  ck_assert (fz_refcount (test_ptr) == 1);
+
+  /* The flag follows the block when it's moved.  */
+  test_ptr = fz_realloc (test_ptr, test_ptr_size + 10000);
+  ck_assert (fz_is_shared (test_ptr) == TRUE);
+}
+END_TEST
+
+/* Finalizer for `test_fz_release'.  */
+static int_t finalized = 0;
+static ptr_t
+test_finalize (ptr_t ptr)
+{
+  ck_assert (fz_refcount (ptr) == 0);
+  ++finalized;
+  return ptr;
+}
+
+/* Test for `fz_release'.  */
+START_TEST (test_fz_release)
+{
+  ptr_t ptr = fz_malloc (10);
+  ck_assert (fz_release (NULL, test_finalize) == -EINVAL);
+  fz_retain (ptr);
+  ck_assert (fz_release (ptr, test_finalize) == 1);
+  ck_assert (finalized == 0);
+  ck_assert (fz_release (ptr, test_finalize) == 0);
+  ck_assert (finalized == 1);
+}
+END_TEST
+
+/* Test for `fz_unref'.  */
+START_TEST (test_fz_unref)
+{
+  ptr_t ptr = fz_malloc (10);
+  ck_assert (fz_unref (NULL) == -EINVAL);
+  ck_assert (fz_set_shared (ptr, TRUE) == 0);
+  fz_retain (ptr);
+  ck_assert (fz_unref (ptr) == 1);
+  ck_assert (fz_unref (ptr) == 0);
+  ck_assert (fz_refcount (ptr) == 1);
+  ck_assert (fz_free (ptr) == 0);
+}
+END_TEST
+
+/* Test for `fz_set_reclaim' and `fz_collect'.  */
+START_TEST (test_fz_set_reclaim)
+{
+  size_t usage = fz_memusage (0);
+  ptr_t ptr;
+
+  ck_assert (fz_set_reclaim (RECLAIM_THREAD + 1) == -EINVAL);
+  ck_assert (fz_collect () == 0);
+
+  /* Releases outside of a render scope are never deferred.  */
+  ck_assert (fz_set_reclaim (RECLAIM_DEFER) == 0);
+  ck_assert (fz_free (fz_malloc (1000)) == 0);
+  ck_assert (fz_collect () == 0);
+
+  /* Releases inside are, but not small slab blocks.  */
+  ck_assert (fz_set_rtpolicy (RTPOLICY_ABORT) == 0);
+  ptr = fz_malloc (1000);
+  fz_rt_enter ();
+  ck_assert (fz_free (ptr) == 0);
+  ck_assert (fz_free (fz_retain (test_ptr)) == 1);
+  fz_rt_leave ();
+  ck_assert (fz_set_rtpolicy (RTPOLICY_IGNORE) == 0);
+  ck_assert (fz_memusage (0) == usage);
+  ck_assert (fz_collect () == 1);
+  ck_assert (fz_collect () == 0);
+
+  /* Blocks moved when grown are deferred as well.  */
+  ptr = fz_malloc_aligned (1000, MEMALIGN_SIMD);
+  fz_rt_enter ();
+  ptr = fz_realloc (ptr, 100000);
+  fz_rt_leave ();
+  ck_assert (fz_collect () == 1);
+  ck_assert (fz_free (ptr) == 0);
+
+  /* Switching back to RECLAIM_NOW collects pending blocks.  */
+  ptr = fz_malloc (1000);
+  fz_rt_enter ();
+  fz_free (ptr);
+  fz_rt_leave ();
+  ck_assert (fz_set_reclaim (RECLAIM_NOW) == 0);
+  ck_assert (fz_collect () == 0);
+
+  /* The background reclaimer is stopped when leaving RECLAIM_THREAD.  */
+  ck_assert (fz_set_reclaim (RECLAIM_THREAD) == 0);
+  ck_assert (fz_set_reclaim (RECLAIM_THREAD) == 0);
+  ptr = fz_malloc (1000);
+  fz_rt_enter ();
+  fz_free (ptr);
+  fz_rt_leave ();
+  ck_assert (fz_set_reclaim (RECLAIM_NOW) == 0);
+  ck_assert (fz_collect () == 0);
+
+  /* The reclaimer keeps running until the last user stops it.  */
+  ck_assert (fz_reclaim_stop () == -EINVAL);
+  ck_assert (fz_reclaim_start () == 0);
+  ck_assert (fz_reclaim_start () == 0);
+  ck_assert (fz_reclaim_stop () == 0);
+  ptr = fz_malloc (1000);
+  fz_rt_enter ();
+  fz_free (ptr);
+  fz_rt_leave ();
+  ck_assert (fz_reclaim_stop () == 0);
+  ck_assert (fz_collect () == 0);
+  ck_assert (fz_reclaim_stop () == -EINVAL);
+}
+END_TEST
+
+/* Test for `fz_set_membudget'.  */
+START_TEST (test_fz_set_membudget)
+{
+  size_t usage = fz_memusage (0);
+  ptr_t ptr;
+  uint_t i;
+
+  ck_assert (fz_membudget () == 0);
+  ck_assert (fz_set_membudget (usage + 1000) == 0);
+  ck_assert (fz_membudget () == usage + 1000);
+
+  errno = 0;
+  ck_assert (fz_malloc (1000) == NULL);
+  ck_assert (errno == ENOMEM);
+  ck_assert (fz_memusage (0) == usage);
+
+  ptr = fz_malloc (500);
+  ck_assert (ptr != NULL);
+  ((char *) ptr)[0] = 1;
+
+  /* A failed grow leaves the block as it was.  */
+  errno = 0;
+  ck_assert (fz_realloc (ptr, 1000) == NULL);
+  ck_assert (errno == ENOMEM);
+  ck_assert (((char *) ptr)[0] == 1);
+  ck_assert (fz_realloc (ptr, 400) == ptr);
+
+  /* Released memory is available again.  */
+  ck_assert (fz_free (ptr) == 0);
+  ptr = fz_malloc (900);
+  ck_assert (ptr != NULL);
+  ck_assert (fz_free (ptr) == 0);
+
+  /* Growing small blocks in place is counted too.  */
+  for (i = 0; i < 2000; ++i)
+    {
+      ptr = fz_malloc (20);
+      ck_assert (fz_realloc (ptr, 30) == ptr);
+      ck_assert (fz_free (ptr) == 0);
+    }
+  ck_assert (fz_malloc (1000) == NULL);
+  ptr = fz_malloc (900);
+  ck_assert (ptr != NULL);
+  ck_assert (fz_free (ptr) == 0);
+
+  ck_assert (fz_set_membudget (0) == 0);
+  ptr = fz_malloc (1000);
+  ck_assert (ptr != NULL);
+  ck_assert (fz_free (ptr) == 0);
+}
+END_TEST
+
+/* Test for `fz_memstats'.  */
+START_TEST (test_fz_memstats)
+{
+  memstats_t stats, thread_stats;
+  ptr_t ptr;
+
+  ck_assert (fz_memstats (NULL, 0) == -EINVAL);
+  ck_assert (fz_memstats (&stats, 0) == 0);
+  ck_assert (stats.meta == fz_memusage (MEMUSAGE_META));
+  ck_assert (stats.disp == fz_memusage (MEMUSAGE_DISP));
+  ck_assert (stats.peak >= stats.meta + stats.disp);
+  ck_assert (stats.nallocs == stats.nfrees + 1);
+
+  /* All allocations so far were made by this thread.  */
+  ck_assert (fz_memstats (&thread_stats, MEMSTATS_THREAD) == 0);
+  ck_assert (thread_stats.meta == stats.meta);
+  ck_assert (thread_stats.disp == stats.disp);
+  ck_assert (thread_stats.nallocs == stats.nallocs);
+
+  /* The high-water mark stays after the block is released.  */
+  fz_memstats_reset_peak ();
+  ptr = fz_malloc (4096);
+  ck_assert (fz_free (ptr) == 0);
+  ck_assert (fz_memstats (&thread_stats, MEMSTATS_THREAD) == 0);
+  ck_assert (thread_stats.peak >= stats.meta + stats.disp + 4096);
+  ck_assert (thread_stats.nallocs == stats.nallocs + 1);
+  ck_assert (thread_stats.nfrees == stats.nfrees + 1);
+  fz_memstats_reset_peak ();
+  ck_assert (fz_memstats (&thread_stats, MEMSTATS_THREAD) == 0);
+  ck_assert (thread_stats.peak == stats.meta + stats.disp);
+}
+END_TEST
+
+/* Thread routine for `test_fz_memstats_threads'.  Allocates blocks
+   that are released by the main thread.  */
+static void *
+memstats_thread (void *arg)
+{
+  ptr_t *ptrs = (ptr_t *) arg;
+  memstats_t stats;
+  int i;
+
+  for (i = 0; i < 100; ++i)
+    ptrs[i] = fz_malloc (100);
+  fz_memstats (&stats, MEMSTATS_THREAD);
+  return (stats.nallocs == 100 && stats.disp == 100 * 100) ? arg : NULL;
+}
+
+/* Test that `fz_memstats' merges the accounts of all threads.  */
+START_TEST (test_fz_memstats_threads)
+{
+  ptr_t ptrs[4][100];
+  pthread_t threads[4];
+  memstats_t before, after;
+  void *result;
+  int i, j;
+
+  fz_memstats (&before, 0);
+  for (i = 0; i < 4; ++i)
+    ck_assert (pthread_create (&threads[i], NULL, memstats_thread,
+                               ptrs[i]) == 0);
+  for (i = 0; i < 4; ++i)
+    {
+      ck_assert (pthread_join (threads[i], &result) == 0);
+      ck_assert (result == ptrs[i]);
+    }
+
+  fz_memstats (&after, 0);
+  ck_assert (after.nallocs == before.nallocs + 400);
+  ck_assert (after.disp == before.disp + 400 * 100);
+
+  for (i = 0; i < 4; ++i)
+    for (j = 0; j < 100; ++j)
+      ck_assert (fz_free (ptrs[i][j]) == 0);
+
+  fz_memstats (&after, 0);
+  ck_assert (after.nfrees == before.nfrees + 400);
+  ck_assert (after.disp == before.disp);
+  ck_assert (after.meta == before.meta);
+}
+END_TEST
+
+/* `memtrace_f' keeping a copy of the last record.  */
+static void
+test_memtrace (const memtrace_t *record, ptr_t data)
+{
+  *(memtrace_t *) data = *record;
+}
+
+/* Test for `fz_set_memtrace'.  */
+START_TEST (test_fz_set_memtrace)
+{
+  memtrace_t record = {0, NULL, 0, NULL, FALSE};
+  ptr_t ptr;
+
+  fz_set_memtrace (test_memtrace, &record);
+  ptr = fz_malloc (100);
+  ck_assert (record.op == MEMTRACE_ALLOC);
+  ck_assert (record.ptr == ptr);
+  ck_assert (record.len == 100);
+  ck_assert (record.caller != NULL);
+  ck_assert (record.rt == FALSE);
+
+  fz_rt_enter ();
+  ck_assert (fz_rt_active () == TRUE);
+  ptr = fz_realloc (ptr, 50);
+  ck_assert (record.op == MEMTRACE_RESIZE);
+  ck_assert (record.rt == TRUE);
+  ptr = fz_realloc (ptr, 4096);
+  ck_assert (record.op == MEMTRACE_GROW);
+  ck_assert (record.ptr == ptr);
+  fz_rt_leave ();
+  ck_assert (fz_rt_active () == FALSE);
+
+  fz_retain (ptr);
+  ck_assert (fz_free (ptr) == 1);
+  ck_assert (record.op == MEMTRACE_UNREF);
+  ck_assert (fz_free (ptr) == 0);
+  ck_assert (record.op == MEMTRACE_FREE);
+  ck_assert (record.rt == FALSE);
+
+  fz_set_memtrace (NULL, NULL);
+  record.op = MEMTRACE_UNREF;
+  fz_free (fz_malloc (10));
+  ck_assert (record.op == MEMTRACE_UNREF);
+}
+END_TEST
+
+/* Test for `fz_set_rtpolicy'.  */
+START_TEST (test_fz_set_rtpolicy)
+{
+  ck_assert (fz_set_rtpolicy (RTPOLICY_ABORT + 1) == -EINVAL);
+  ck_assert (fz_set_rtpolicy (RTPOLICY_IGNORE) == 0);
+  fz_rt_enter ();
+  fz_free (fz_malloc (10));
+  fz_rt_leave ();
+
+  /* Allocations outside of a render scope are always fine.  */
+  ck_assert (fz_set_rtpolicy (RTPOLICY_ABORT) == 0);
+  fz_free (fz_malloc (10));
+  fz_rt_enter ();
+  fz_rt_enter ();
+  fz_rt_leave ();
+  (void) fz_malloc (10); /* Aborts.  */
+}
+END_TEST
+
 /* Initiate a malloc test suite struct.  */
 Suite *
 malloc_suite_create ()
@@ -138,6 +512,16 @@ malloc_suite_create ()
   tcase_add_test (t, tets_fz_refcount);
   tcase_add_test (t, test_fz_free);
   tcase_add_test (t, test_fz_memusage);
+  tcase_add_test (t, test_fz_malloc_aligned);
+  tcase_add_test (t, test_fz_set_shared);
+  tcase_add_test (t, test_fz_release);
+  tcase_add_test (t, test_fz_unref);
+  tcase_add_test (t, test_fz_set_reclaim);
+  tcase_add_test (t, test_fz_set_membudget);
+  tcase_add_test (t, test_fz_memstats);
+  tcase_add_test (t, test_fz_memstats_threads);
+  tcase_add_test (t, test_fz_set_memtrace);
+  tcase_add_test_raise_signal (t, test_fz_set_rtpolicy, SIGABRT);
   suite_add_tcase (s, t);
   return s;
 }
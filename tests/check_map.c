@@ -172,7 +172,7 @@ START_TEST (test_map_next)
   size_t nitems = 100;
   item_t *item;
   uintptr_t keysum = 0;
-  uint_t valsum;
+  uint_t valsum = 0;
 
   /* Populate map and calculate key / value sums.  */
   for (i = 0; i < nitems; ++i)
@@ -195,6 +195,152 @@ START_TEST (test_map_next)
 }
 END_TEST
 
+/* Test that `fz_map_next' iterates in insertion order.  */
+START_TEST (test_map_order)
+{
+  uint_t i;
+  size_t nitems = 100;
+  uintptr_t key, last = 0;
+  uintptr_t *value;
+  map_t *map = fz_new (map_c, NULL, NULL, NULL);
+
+  for (i = 0; i < nitems; ++i)
+    {
+      key = (uintptr_t) rand ();
+      if (fz_map_get (map, key) == NULL)
+        fz_map_set (map, key, &key, sizeof (uintptr_t));
+    }
+
+  /* Unset some values and set a new last one.  */
+  key = fz_map_key (fz_map_next (map, NULL));
+  fz_map_unset (map, key);
+  key = fz_map_key (fz_map_next (map, fz_map_next (map, NULL)));
+  fz_map_unset (map, key);
+  fz_map_set (map, key, &key, sizeof (uintptr_t));
+
+  i = 0;
+  fz_map_each (map, value)
+    {
+      ck_assert (fz_map_key (value) == *value);
+      ck_assert (fz_map_get (map, *value) == value);
+      last = *value;
+      ++i;
+    }
+  ck_assert_int_eq (i, fz_len (map));
+  ck_assert (last == key);
+
+  /* Unsetting the current value doesn't skip the next one.  */
+  nitems = fz_len (map);
+  i = 0;
+  fz_map_each (map, value)
+    if (i++ % 2 == 0)
+      fz_map_unset (map, *value);
+  ck_assert_int_eq (i, nitems);
+  ck_assert_int_eq (fz_len (map), nitems / 2);
+
+  /* Unset keys can be set again and go last.  */
+  for (i = 0; i < 1000; ++i)
+    {
+      key = fz_map_key (fz_map_next (map, NULL));
+      fz_map_unset (map, key);
+      fz_map_set (map, key, &key, sizeof (uintptr_t));
+    }
+  ck_assert_int_eq (fz_len (map), nitems / 2);
+  i = 0;
+  fz_map_each (map, value)
+    {
+      ck_assert (fz_map_get (map, *value) == value);
+      last = *value;
+      ++i;
+    }
+  ck_assert_int_eq (i, nitems / 2);
+  ck_assert (last == key);
+
+  fz_del (map);
+}
+END_TEST
+
+/* Test that the map grows and keeps values in place.  */
+START_TEST (test_map_grow)
+{
+  uint_t i;
+  size_t nitems = 1000;
+  map_t *map = fz_new (map_c, NULL, NULL, NULL);
+  uintptr_t *keys = fz_malloc (nitems * sizeof (uintptr_t));
+  uintptr_t **values = fz_malloc (nitems * sizeof (uintptr_t *));
+
+  /* Pointer like keys with equal low bits.  */
+  for (i = 0; i < nitems; ++i)
+    {
+      keys[i] = ((uintptr_t) map) + i * 64;
+      values[i] = fz_map_set (map, keys[i], &keys[i], sizeof (uintptr_t));
+      ck_assert (values[i] != NULL);
+    }
+  ck_assert_int_eq (fz_len (map), nitems);
+
+  for (i = 0; i < nitems; ++i)
+    {
+      ck_assert (fz_map_get (map, keys[i]) == values[i]);
+      ck_assert (*values[i] == keys[i]);
+    }
+
+  /* Unset every other item and set them again.  */
+  for (i = 0; i < nitems; i += 2)
+    fz_map_unset (map, keys[i]);
+  ck_assert_int_eq (fz_len (map), nitems / 2);
+  for (i = 0; i < nitems; ++i)
+    ck_assert ((fz_map_get (map, keys[i]) == NULL) == (i % 2 == 0));
+  for (i = 0; i < nitems; i += 2)
+    fz_map_set (map, keys[i], &keys[i], sizeof (uintptr_t));
+  ck_assert_int_eq (fz_len (map), nitems);
+  for (i = 0; i < nitems; ++i)
+    ck_assert (*((uintptr_t *) fz_map_get (map, keys[i])) == keys[i]);
+
+  fz_free (values);
+  fz_free (keys);
+  fz_del (map);
+}
+END_TEST
+
+/* Test that values can grow beyond the size they were set with.  */
+START_TEST (test_map_grow_value)
+{
+  uint_t i;
+  map_t *map = fz_new (map_c, NULL, NULL, NULL);
+  uint_t small[4] = {1, 2, 3, 4};
+  uint_t large[256] = {0};
+  uint_t *value;
+
+  for (i = 0; i < 64; ++i)
+    large[i] = i * i;
+
+  fz_map_set (map, 3, small, sizeof (small));
+  value = fz_map_set (map, 7, small, sizeof (small));
+  ck_assert (value != NULL && value[3] == 4);
+  value = fz_map_set (map, 7, large, 64 * sizeof (uint_t));
+  ck_assert (value != NULL);
+  value = fz_map_set (map, 7, large, sizeof (large));
+  ck_assert (value != NULL);
+  ck_assert_int_eq (fz_len (map), 2);
+  ck_assert (fz_map_next (map, fz_map_get (map, 3)) == value);
+  ck_assert (fz_map_get (map, 7) == value);
+  for (i = 0; i < 64; ++i)
+    ck_assert (value[i] == i * i);
+  ck_assert (fz_map_key (value) == 7);
+
+  /* Smaller values are stored in place.  */
+  value = fz_map_set (map, 7, small, sizeof (small));
+  ck_assert (fz_map_get (map, 7) == value);
+  ck_assert (value[0] == 1 && value[3] == 4);
+
+  fz_map_unset (map, 7);
+  fz_map_unset (map, 3);
+  ck_assert_int_eq (fz_len (map), 0);
+  ck_assert (fz_map_next (map, NULL) == NULL);
+  fz_del (map);
+}
+END_TEST
+
 /* Initiate a map test suite struct.  */
 Suite *
 map_suite_create ()
@@ -207,6 +353,9 @@ map_suite_create ()
   tcase_add_test (t, test_map_setval);
   tcase_add_test (t, test_map_key);
   tcase_add_test (t, test_map_next);
+  tcase_add_test (t, test_map_order);
+  tcase_add_test (t, test_map_grow);
+  tcase_add_test (t, test_map_grow_value);
   suite_add_tcase (s, t);
   return s;
 }
@@ -136,6 +136,37 @@ START_TEST (test_fz_mod_state_data)
 }
 END_TEST
 
+/* Test `fz_mod_state_data' with voices that have slots.  */
+START_TEST (test_fz_mod_state_slots)
+{
+  vpool_t *pool = fz_new (vpool_c, (size_t) 2);
+  const list_t *voices = fz_vpool_all_voices (pool);
+  voice_t *voice1 = fz_ref_at (voices, 0, voice_t);
+  voice_t *voice2 = fz_ref_at (voices, 1, voice_t);
+  int_t *state1, *state2;
+
+  modulator->state_size = sizeof (int_t);
+  state1 = fz_mod_state (modulator, voice1, int_t);
+  state2 = fz_mod_state (modulator, voice2, int_t);
+  ck_assert (state1 != NULL && state2 != NULL && state1 != state2);
+  ck_assert (*state1 == 0 && *state2 == 0);
+  ck_assert_int_eq (fz_len (modulator->states), 0);
+
+  *state1 = 1;
+  ck_assert (fz_mod_state (modulator, voice1, int_t) == state1);
+  ck_assert (*state1 == 1);
+
+  /* States of a later voice in the same slot start from zero.  */
+  fz_del (pool);
+  pool = fz_new (vpool_c, (size_t) 1);
+  voice1 = fz_ref_at (fz_vpool_all_voices (pool), 0, voice_t);
+  state1 = fz_mod_state (modulator, voice1, int_t);
+  ck_assert (state1 != NULL && *state1 == 0);
+
+  fz_del (pool);
+}
+END_TEST
+
 /* Test for `fz_mod_render'.  */
 START_TEST (test_fz_mod_render)
 {
@@ -186,6 +217,7 @@ mod_suite_create ()
   TCase *t = tcase_create ("modulator");
   tcase_add_checked_fixture (t, setup, teardown);
   tcase_add_test (t, test_fz_mod_state_data);
+  tcase_add_test (t, test_fz_mod_state_slots);
   tcase_add_test (t, test_fz_mod_render);
   suite_add_tcase (s, t);
   return s;
@@ -26,6 +26,7 @@
 #include "mod.h"
 #include "private-mod.h"
 #include "list.h"
+#include "voice.h"
 
 #define TEST_MOD_SLOT 1
 
@@ -250,11 +251,115 @@ START_TEST (test_fz_node_connect)
                "Expected node to have 2 unique mods but got '%d'",
                fz_len (mods));
 
+  /* Connecting fails rather than crashes when out of memory.  */
+  fz_set_membudget (fz_memusage (0));
+  for (i = 0, err = 0; i < 64 && err == 0; ++i)
+    err = fz_node_connect (test_node, mod, TEST_MOD_SLOT + 3 + i, NULL);
+  fz_set_membudget (0);
+  ck_assert_int_eq (err, ENOMEM);
+
   fz_del (mods);
   fz_del (frames);
 }
 END_TEST
 
+/* Number of `test_state_init' and `test_state_free' calls.  */
+static int_t test_state_inits = 0;
+static int_t test_state_frees = 0;
+
+static void
+test_state_init (node_t *node, voice_t *voice, ptr_t state)
+{
+  (void) node;
+  (void) voice;
+  *((int_t *) state) = ++test_state_inits;
+}
+
+static void
+test_state_free (node_t *node, voice_t *voice, ptr_t state)
+{
+  (void) node;
+  (void) voice;
+  (void) state;
+  ++test_state_frees;
+}
+
+/* Test `fz_node_state' for voices with and without slots.  */
+START_TEST (test_fz_node_state)
+{
+  vpool_t *pool = fz_new (vpool_c, (size_t) 2);
+  const list_t *voices = fz_vpool_all_voices (pool);
+  voice_t *voice1 = fz_ref_at (voices, 0, voice_t);
+  voice_t *voice2 = fz_ref_at (voices, 1, voice_t);
+  voice_t *voice3 = fz_new (voice_c);
+  int_t *state1, *state2, *state3;
+  uint_t slot1 = voice1->slot;
+
+  test_node->state_size = sizeof (int_t);
+  test_node->state_init = test_state_init;
+  test_node->state_free = test_state_free;
+  test_state_inits = test_state_frees = 0;
+
+  ck_assert (voice1->slot != VOICE_SLOT_NONE);
+  ck_assert (voice2->slot != VOICE_SLOT_NONE);
+  ck_assert (voice1->slot != voice2->slot);
+  ck_assert (voice3->slot == VOICE_SLOT_NONE);
+
+  state1 = fz_node_state (test_node, voice1);
+  state2 = fz_node_state (test_node, voice2);
+  state3 = fz_node_state (test_node, voice3);
+  ck_assert (state1 != NULL && state2 != NULL && state3 != NULL);
+  ck_assert (state1 != state2 && state2 != state3);
+  ck_assert_int_eq (test_state_inits, 3);
+  ck_assert (*state1 == 1 && *state2 == 2 && *state3 == 3);
+
+  /* States are kept, and voices with slots are not retained.  */
+  ck_assert (fz_node_state (test_node, voice1) == state1);
+  ck_assert (fz_node_state (test_node, voice3) == state3);
+  ck_assert_int_eq (test_state_inits, 3);
+  ck_assert_int_eq (fz_refcount (voice1), 1);
+  ck_assert_int_eq (fz_refcount (voice3), 2);
+
+  /* A new voice in the same slot gets a new state.  */
+  fz_del (pool);
+  pool = fz_new (vpool_c, (size_t) 1);
+  voice1 = fz_ref_at (fz_vpool_all_voices (pool), 0, voice_t);
+  ck_assert (voice1->slot == slot1);
+  state1 = fz_node_state (test_node, voice1);
+  ck_assert_int_eq (test_state_frees, 1);
+  ck_assert_int_eq (test_state_inits, 4);
+  ck_assert (*state1 == 4);
+
+  fz_del (pool);
+  fz_del (voice3);
+}
+END_TEST
+
+/* Test that `fz_node_reserve' makes room for all voice slots.  */
+START_TEST (test_fz_node_reserve)
+{
+  vpool_t *pool = fz_new (vpool_c, (size_t) 16);
+  const list_t *voices = fz_vpool_all_voices (pool);
+  voice_t *first = fz_ref_at (voices, 0, voice_t);
+  voice_t *last = fz_ref_at (voices, 15, voice_t);
+  size_t usage;
+  ptr_t state;
+
+  test_node->state_size = sizeof (real_t);
+  ck_assert_int_eq (fz_node_reserve (NULL, first, FALSE), -EINVAL);
+  ck_assert_int_eq (fz_node_reserve (test_node, first, FALSE), 0);
+
+  /* Other voices use the reserved states without moving them.  */
+  state = fz_node_state (test_node, first);
+  usage = fz_memusage (0);
+  ck_assert (fz_node_state (test_node, last) != NULL);
+  ck_assert_int_eq (fz_memusage (0), usage);
+  ck_assert (fz_node_state (test_node, first) == state);
+
+  fz_del (pool);
+}
+END_TEST
+
 /* Initiate a node test suite struct.  */
 Suite *
 node_suite_create ()
@@ -264,6 +369,8 @@ node_suite_create ()
   tcase_add_checked_fixture (t, setup, teardown);
   tcase_add_test (t, test_fz_node_render);
   tcase_add_test (t, test_fz_node_connect);
+  tcase_add_test (t, test_fz_node_state);
+  tcase_add_test (t, test_fz_node_reserve);
   suite_add_tcase (s, t);
   return s;
 }
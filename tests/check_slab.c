@@ -0,0 +1,165 @@
+/* Tests for `slab.c' functions.
+   Copyright (C) 2013-2015 Henrik Hedelund.
+
+   This file is part of libfreeztile.
+
+   libfreeztile is free software; you can redistribute it and/or modify it under
+   the terms of the GNU General Public License as published by the Free
+   Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   libfreeztile is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or
+   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libfreeztile; see the file COPYING.  If not see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+#include "malloc.h"
+#include "slab.h"
+#include "list.h"
+
+/* Pre-test hook.  */
+void
+setup ()
+{
+  ck_assert_int_eq (fz_memusage (0), 0);
+}
+
+/* Post-test hook.  */
+void
+teardown ()
+{
+  uint_t i;
+  ck_assert_int_eq (fz_memusage (0), 0);
+  for (i = 0; i < fz_memclass_count (); ++i)
+    ck_assert_int_eq (fz_memusage_class (i, MEMUSAGE_DISP), 0);
+}
+
+/* Test for `fz_slab_alloc' and `fz_slab_free'.  */
+START_TEST (test_fz_slab_alloc)
+{
+  char *a = fz_slab_alloc (24);
+  char *b = fz_slab_alloc (24);
+  ck_assert (a != NULL && b != NULL && a != b);
+  ck_assert (fz_slab_capacity (a) >= 24);
+
+  /* Blocks of the same class should be packed densely.  */
+  ck_assert ((size_t) (a > b ? a - b : b - a) == fz_slab_capacity (a));
+
+  /* Freed blocks should be recycled first.  */
+  fz_slab_free (b);
+  ck_assert (fz_slab_alloc (24) == b);
+  fz_slab_free (b);
+  fz_slab_free (a);
+
+  /* Large blocks aren't handled by the slab allocator.  */
+  ck_assert (fz_slab_alloc (SLAB_BLOCK_MAX + 1) == NULL);
+}
+END_TEST
+
+/* Test for `fz_memusage_class'.  */
+START_TEST (test_fz_memusage_class)
+{
+  uint_t i;
+  uint_t index = fz_memclass_count ();
+  list_t *list = fz_new_simple_vector (int_t);
+  size_t reserved = 0;
+
+  /* Find the class LIST was allocated from.  */
+  for (i = 0; i < fz_memclass_count (); ++i)
+    if (fz_memusage_class (i, MEMUSAGE_DISP) > 0)
+      index = i;
+  ck_assert (index < fz_memclass_count ());
+  ck_assert (fz_memusage_class (index, MEMUSAGE_DISP)
+             >= fz_memclass_size (index));
+  ck_assert (fz_memusage_class (index, MEMUSAGE_SLAB) >= SLAB_SIZE);
+
+  fz_del (list);
+  ck_assert_int_eq (fz_memusage_class (index, MEMUSAGE_DISP), 0);
+
+  /* Slabs are kept until trimmed.  */
+  for (i = 0; i < fz_memclass_count (); ++i)
+    reserved += fz_memusage_class (i, MEMUSAGE_SLAB);
+  ck_assert (reserved > 0);
+  ck_assert (fz_slab_trim () == reserved);
+  ck_assert_int_eq (fz_memusage_class (index, MEMUSAGE_SLAB), 0);
+
+  ck_assert_int_eq (fz_memclass_size (fz_memclass_count ()), 0);
+}
+END_TEST
+
+/* Allocate and free slab blocks until *DONE is set.  */
+static void *
+test_churn (void *done)
+{
+  ptr_t blocks[16];
+  uint_t i;
+
+  while (!__atomic_load_n ((bool_t *) done, __ATOMIC_ACQUIRE))
+    {
+      for (i = 0; i < 16; ++i)
+        blocks[i] = fz_slab_alloc (24);
+      for (i = 0; i < 16; ++i)
+        if (blocks[i] != NULL)
+          fz_slab_free (blocks[i]);
+    }
+  return NULL;
+}
+
+/* Test that `fz_slab_trim' can run while other threads allocate.  */
+START_TEST (test_fz_slab_trim_concurrent)
+{
+  pthread_t thread;
+  bool_t done = FALSE;
+  ptr_t block;
+  uint_t i;
+
+  ck_assert (pthread_create (&thread, NULL, test_churn, &done) == 0);
+  for (i = 0; i < 2000; ++i)
+    fz_slab_trim ();
+  __atomic_store_n (&done, TRUE, __ATOMIC_RELEASE);
+  pthread_join (thread, NULL);
+
+  /* Blocks freed during a trim are back on their class.  */
+  block = fz_slab_alloc (24);
+  ck_assert (block != NULL);
+  fz_slab_free (block);
+  fz_slab_trim ();
+  for (i = 0; i < fz_memclass_count (); ++i)
+    ck_assert_int_eq (fz_memusage_class (i, MEMUSAGE_SLAB), 0);
+}
+END_TEST
+
+/* Initiate a slab test suite struct.  */
+Suite *
+slab_suite_create ()
+{
+  Suite *s = suite_create ("slab");
+  TCase *t = tcase_create ("slab");
+  tcase_add_checked_fixture (t, setup, teardown);
+  tcase_add_test (t, test_fz_slab_alloc);
+  tcase_add_test (t, test_fz_memusage_class);
+  tcase_add_test (t, test_fz_slab_trim_concurrent);
+  suite_add_tcase (s, t);
+  return s;
+}
+
+/* Run all slab tests.  */
+int
+main ()
+{
+  int fail_count = 0;
+  Suite *suite = slab_suite_create ();
+  SRunner *runner = srunner_create (suite);
+  srunner_run_all (runner, CK_NORMAL);
+  fail_count = srunner_ntests_failed (runner);
+  srunner_free (runner);
+  free (suite);
+  return fail_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
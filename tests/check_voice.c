@@ -23,6 +23,7 @@
 #include <math.h>
 #include <errno.h>
 #include "malloc.h"
+#include "list.h"
 #include "voice.h"
 
 voice_t *voice = NULL;
@@ -163,6 +164,111 @@ START_TEST (test_fz_note_frequency)
 }
 END_TEST
 
+/* Get the active voice in POOL playing note ID, or NULL.  */
+static voice_t *
+vpool_find (vpool_t *pool, uint_t id)
+{
+  real_t freq = A4_FREQ * pow (TWELFTH_ROOT_OF_TWO, (int_t) id - A4_ID);
+  const list_t *voices = fz_vpool_voices (pool);
+  uint_t i;
+
+  for (i = 0; i < fz_len ((const ptr_t) voices); ++i)
+    if (fz_voice_frequency (fz_ref_at (voices, i, voice_t)) == freq)
+      return fz_ref_at (voices, i, voice_t);
+
+  return NULL;
+}
+
+/* Test voice pool lookups by id, below and above the id table size.  */
+START_TEST (test_fz_vpool_ids)
+{
+  vpool_t *pool = fz_new (vpool_c, (size_t) 2);
+  voice_t *low, *high;
+
+  ck_assert_int_eq (fz_vpool_press (pool, 60, 1), 0);
+  ck_assert_int_eq (fz_vpool_press (pool, 1000, 1), 0);
+  low = vpool_find (pool, 60);
+  high = vpool_find (pool, 1000);
+  ck_assert (low != NULL && high != NULL && low != high);
+  ck_assert_int_eq (fz_len ((const ptr_t) fz_vpool_voices (pool)), 2);
+
+  /* Pressed ids are found and can't be pressed again.  */
+  ck_assert_int_eq (fz_vpool_press (pool, 60, 1), EINVAL);
+  ck_assert_int_eq (fz_vpool_press (pool, 1000, 1), EINVAL);
+
+  /* Steal the first voice and give it back on release.  */
+  ck_assert_int_eq (fz_vpool_press (pool, 200, 1), 0);
+  ck_assert (vpool_find (pool, 60) == NULL);
+  ck_assert (vpool_find (pool, 200) == low);
+  ck_assert_int_eq (fz_vpool_release (pool, 200), 0);
+  ck_assert (vpool_find (pool, 60) == low);
+  ck_assert (fz_voice_repossessed (low));
+  ck_assert (fz_voice_pressed (low));
+  ck_assert_int_eq (fz_vpool_release (pool, 200), 0);
+  ck_assert (fz_voice_pressed (low));
+  ck_assert_int_eq (fz_vpool_release (pool, 60), 0);
+  ck_assert (!fz_voice_pressed (low));
+
+  /* Killed voices can be pressed with other ids.  */
+  ck_assert_int_eq (fz_vpool_kill_id (pool, 1000), 0);
+  ck_assert (vpool_find (pool, 1000) == NULL);
+  ck_assert_int_eq (fz_len ((const ptr_t) fz_vpool_voices (pool)), 1);
+  ck_assert_int_eq (fz_vpool_kill_id (pool, 1000), 0);
+  ck_assert_int_eq (fz_vpool_press (pool, 904, 1), 0);
+  ck_assert (vpool_find (pool, 904) == high);
+  ck_assert_int_eq (fz_vpool_kill (pool, low), 0);
+  ck_assert_int_eq (fz_vpool_kill_id (pool, 904), 0);
+  ck_assert_int_eq (fz_len ((const ptr_t) fz_vpool_voices (pool)), 0);
+  ck_assert_int_eq (fz_vpool_press (pool, 1000, 1), 0);
+  ck_assert_int_eq (fz_vpool_press (pool, 60, 1), 0);
+  ck_assert_int_eq (fz_len ((const ptr_t) fz_vpool_voices (pool)), 2);
+
+  /* Stolen ids pressed again aren't repossessed.  */
+  ck_assert_int_eq (fz_vpool_press (pool, 1001, 1), 0);
+  low = vpool_find (pool, 1001);
+  ck_assert_int_eq (fz_vpool_press (pool, 1000, 1), 0);
+  high = vpool_find (pool, 1000);
+  ck_assert (low != high);
+  ck_assert_int_eq (fz_vpool_release (pool, 1001), 0);
+  ck_assert (vpool_find (pool, 60) == low);
+  ck_assert_int_eq (fz_vpool_release (pool, 60), 0);
+  ck_assert (vpool_find (pool, 60) == low && !fz_voice_pressed (low));
+  ck_assert (vpool_find (pool, 1000) == high && fz_voice_pressed (high));
+  ck_assert_int_eq (fz_vpool_kill_id (pool, 1000), 0);
+  ck_assert (vpool_find (pool, 1000) == NULL);
+  ck_assert (vpool_find (pool, 60) == low);
+
+  fz_del (pool);
+}
+END_TEST
+
+/* Test that large ids that can't be added are reported.  */
+START_TEST (test_fz_vpool_ids_nomem)
+{
+  vpool_t *pool = fz_new (vpool_c, (size_t) 64);
+  uint_t id;
+  int_t err;
+
+  /* Press large ids until the id map can't grow.  */
+  fz_set_membudget (fz_memusage (0));
+  for (id = 1000, err = 0; id < 1064 && err == 0; ++id)
+    err = fz_vpool_press (pool, id, 1);
+  fz_set_membudget (0);
+  ck_assert_int_eq (err, ENOMEM);
+  ck_assert (vpool_find (pool, id - 1) == NULL);
+  ck_assert_int_eq (fz_len ((const ptr_t) fz_vpool_voices (pool)),
+                    id - 1001);
+
+  /* The voice went back to the idle ones.  */
+  ck_assert_int_eq (fz_vpool_press (pool, id - 1, 1), 0);
+  ck_assert (vpool_find (pool, id - 1) != NULL);
+  ck_assert_int_eq (fz_len ((const ptr_t) fz_vpool_voices (pool)),
+                    id - 1000);
+
+  fz_del (pool);
+}
+END_TEST
+
 /* Initiate a voice test suite struct.  */
 Suite *
 voice_suite_create ()
@@ -173,6 +279,8 @@ voice_suite_create ()
   tcase_add_test (t, test_fz_voice_press_pos);
   tcase_add_test (t, test_fz_voice_press_neg);
   tcase_add_test (t, test_fz_note_frequency);
+  tcase_add_test (t, test_fz_vpool_ids);
+  tcase_add_test (t, test_fz_vpool_ids_nomem);
   suite_add_tcase (s, t);
   return s;
 }